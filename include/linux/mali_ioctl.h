@@ -402,6 +402,39 @@ typedef struct
 	u32 memory_size;                /**< [out] total MALI address space available */
 } _mali_uk_init_mem_s;
 
+/** @brief Arguments for _mali_ukk_get_big_block()
+ *
+ * - type_id should be set to the value of the identifier member of one of the
+ * _mali_mem_info structures returned through _mali_ukk_get_system_info()
+ * - ukk_private must be zero when calling from user-side.
+ * - minimum_size_requested will be updated if it is too small
+ * - block_size will always be >= minimum_size_requested, because the underlying
+ * allocation mechanism may only be able allocate multiples of certain size
+ * (e.g. a page). The real size of the block is returned in memory_size.
+ * - The cookie is used in subsequent calls to _mali_ukk_free_big_block().
+ */
+typedef struct
+{
+    void *ctx;                      /**< [in,out] user-kernel context (trashed on output) */
+	u32 type_id;                    /**< [in] the type id of the memory bank to allocate memory from */
+	u32 minimum_size_requested;     /**< [in,out] minimum size of the allocation */
+	u32 ukk_private;                /**< [in] Kernel-side private word inserted by certain U/K interface implementations. Caller must set to Zero. */
+	u32 mali_address;               /**< [out] address of the allocated block in MALI address space */
+	u32 memory_size;                /**< [out] size of the allocated block */
+	u32 cookie;                     /**< [out] identifier for the allocated block in kernel space */
+} _mali_uk_get_big_block_s;
+
+/** @brief Arguments for _mali_ukk_free_big_block()
+ *
+ * All that is required is that the cookie returned by _mali_ukk_get_big_block()
+ * is passed back.
+ */
+typedef struct
+{
+    void *ctx;                      /**< [in,out] user-kernel context (trashed on output) */
+	u32 cookie;                     /**< [in] identifier for the block, as returned by _mali_ukk_get_big_block() */
+} _mali_uk_free_big_block_s;
+
 
 /** @brief Arguments for _mali_ukk_get_pp_core_version()
  *
@@ -415,6 +448,42 @@ typedef struct
     _mali_core_version version;     /**< [out] version returned from core, see \ref _mali_core_version  */
 } _mali_uk_get_pp_core_version_s;
 
+/** @brief Arguments for _mali_ukk_get_pp_number_of_cores()
+ *
+ * - pass in the user-kernel context @c ctx that was returned from _mali_ukk_open()
+ * - Upon successful return from _mali_ukk_get_pp_number_of_cores(), @c number_of_cores
+ * contains the number of Fragment Processor cores in the system.
+ */
+typedef struct
+{
+    void *ctx;                      /**< [in,out] user-kernel context (trashed on output) */
+    u32 number_of_cores;            /**< [out] number of Fragment Processor cores in the system */
+} _mali_uk_get_pp_number_of_cores_s;
+
+/** @brief Arguments for _mali_ukk_gp_abort_job()
+ *
+ * - pass in the user-kernel context @c ctx that was returned from _mali_ukk_open()
+ * - set @c abort_id to the abort id that was passed in when starting the job(s)
+ * Jobs with this abort id are aborted, and finish with _MALI_UK_JOB_STATUS_END_ABORT.
+ */
+typedef struct
+{
+    void *ctx;                      /**< [in,out] user-kernel context (trashed on output) */
+    u32 abort_id;                   /**< [in] ID of job(s) to abort */
+} _mali_uk_gp_abort_job_s;
+
+/** @brief Arguments for _mali_ukk_pp_abort_job()
+ *
+ * - pass in the user-kernel context @c ctx that was returned from _mali_ukk_open()
+ * - set @c abort_id to the abort id that was passed in when starting the job(s)
+ * Jobs with this abort id are aborted, and finish with _MALI_UK_JOB_STATUS_END_ABORT.
+ */
+typedef struct
+{
+    void *ctx;                      /**< [in,out] user-kernel context (trashed on output) */
+    u32 abort_id;                   /**< [in] ID of job(s) to abort */
+} _mali_uk_pp_abort_job_s;
+
 /** @defgroup _mali_uk_gpstartjob_s Vertex Processor Start Job
  * @{ */
 
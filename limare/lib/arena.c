@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Bump allocation of host side objects which only live for a frame. All
+ * allocations are dropped in one go, and the blocks are kept around for
+ * the next frame.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_HEADER ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & \
+		      ~(ARENA_ALIGN - 1))
+
+static struct arena_block *
+arena_block_new(int size)
+{
+	struct arena_block *block;
+
+	block = malloc(ARENA_HEADER + size);
+	if (!block) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	return block;
+}
+
+struct arena *
+arena_create(int block_size)
+{
+	struct arena *arena;
+
+	arena = calloc(1, sizeof(struct arena));
+	if (!arena) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	arena->block_size = block_size;
+
+	arena->blocks = arena_block_new(block_size);
+	if (!arena->blocks) {
+		free(arena);
+		return NULL;
+	}
+	arena->current = arena->blocks;
+
+	return arena;
+}
+
+void
+arena_destroy(struct arena *arena)
+{
+	struct arena_block *block = arena->blocks;
+
+	while (block) {
+		struct arena_block *next = block->next;
+
+		free(block);
+		block = next;
+	}
+
+	free(arena);
+}
+
+void *
+arena_alloc(struct arena *arena, int size)
+{
+	struct arena_block *block = arena->current;
+	void *address;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	/* move on to the next block, which is kept from previous frames. */
+	while ((block->used + size) > block->size) {
+		if (!block->next ||
+		    (size > block->next->size)) {
+			struct arena_block *new;
+			int block_size = arena->block_size;
+
+			if (size > block_size)
+				block_size = size;
+
+			new = arena_block_new(block_size);
+			if (!new)
+				return NULL;
+
+			new->next = block->next;
+			block->next = new;
+		}
+
+		block = block->next;
+		arena->current = block;
+	}
+
+	address = ((void *) block) + ARENA_HEADER + block->used;
+	block->used += size;
+
+	return address;
+}
+
+void *
+arena_calloc(struct arena *arena, int size)
+{
+	void *address = arena_alloc(arena, size);
+
+	if (address)
+		memset(address, 0, size);
+
+	return address;
+}
+
+void
+arena_reset(struct arena *arena)
+{
+	struct arena_block *block;
+
+	for (block = arena->blocks; block; block = block->next)
+		block->used = 0;
+
+	arena->current = arena->blocks;
+}
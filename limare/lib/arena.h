@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Bump allocation of host side objects which only live for a frame.
+ */
+
+#ifndef LIMARE_ARENA_H
+#define LIMARE_ARENA_H 1
+
+struct arena_block {
+	struct arena_block *next;
+	int size;
+	int used;
+};
+
+struct arena {
+	struct arena_block *blocks;
+	struct arena_block *current;
+	int block_size;
+};
+
+struct arena *arena_create(int block_size);
+void arena_destroy(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, int size);
+void *arena_calloc(struct arena *arena, int size);
+void arena_reset(struct arena *arena);
+
+#endif /* LIMARE_ARENA_H */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * All access to the device goes through a backend: either the real mali
+ * kernel driver, or a simulation of it, for hosts without a mali.
+ *
+ * Functions returning int return 0 on success.
+ */
+
+#ifndef LIMARE_BACKEND_H
+#define LIMARE_BACKEND_H 1
+
+struct limare_backend {
+	const char *name;
+
+	int (*open)(struct limare_state *state);
+	/* undoes open, also when open failed. */
+	void (*close)(struct limare_state *state);
+
+	/* fills in type, pp_core_count and mem_type_id of the state. */
+	int (*system_info)(struct limare_state *state);
+
+	/* returns where our initial window of gpu memory lives. */
+	int (*mem_init)(struct limare_state *state, unsigned int *physical);
+
+	void *(*mmap)(struct limare_state *state, unsigned int physical,
+		      int size);
+	void (*munmap)(struct limare_state *state, void *address, int size);
+
+	int (*big_block_get)(struct limare_state *state, int size,
+			     unsigned int *physical, int *real_size,
+			     unsigned int *cookie);
+	void (*big_block_free)(struct limare_state *state,
+			       unsigned int cookie);
+
+	/* request is the start ioctl, job its argument, status gets set. */
+	int (*job_start)(struct limare_state *state, unsigned long request,
+			 void *job);
+	int (*job_abort)(struct limare_state *state, int core,
+			 unsigned int abort_id);
+
+	/* blocks for at most wait->code.timeout ms. */
+	int (*notification_wait)(struct limare_state *state,
+				 _mali_uk_wait_for_notification_s *wait);
+};
+
+extern const struct limare_backend limare_backend_mali;
+extern const struct limare_backend limare_backend_sim;
+
+#endif /* LIMARE_BACKEND_H */
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Backend for the mali kernel driver.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define u32 uint32_t
+#include "linux/mali_ioctl.h"
+
+#include "linux/ioctl.h"
+#include "limare.h"
+#include "jobs.h"
+#include "backend.h"
+
+static int
+mali_open(struct limare_state *state)
+{
+	state->fd = open("/dev/mali", O_RDWR);
+	if (state->fd == -1) {
+		printf("Error: Failed to open /dev/mali: %s\n",
+		       strerror(errno));
+		return errno;
+	}
+
+	return 0;
+}
+
+static void
+mali_close(struct limare_state *state)
+{
+	if (state->fd != -1)
+		close(state->fd);
+	state->fd = -1;
+}
+
+/*
+ * Mali-400 MP comes with up to 4 pp cores, which each get their own part
+ * of the screen.
+ */
+static int
+mali_pp_cores_detect(struct limare_state *state)
+{
+	_mali_uk_get_pp_number_of_cores_s cores = { 0 };
+	int ret;
+
+	state->pp_core_count = 1;
+
+	if (state->type != 400)
+		return 0;
+
+	cores.ctx = (void *) state->fd;
+	ret = ioctl(state->fd, MALI_IOC_PP_NUMBER_OF_CORES_GET, &cores);
+	if (ret == -1) {
+		printf("%s: Error: ioctl(PP_NUMBER_OF_CORES_GET) failed: %s\n",
+		       __func__, strerror(errno));
+		return 0;
+	}
+
+	if (cores.number_of_cores > 1) {
+		printf("Detected %d PP cores.\n", cores.number_of_cores);
+		state->pp_core_count = cores.number_of_cores;
+	}
+
+	return 0;
+}
+
+static int
+mali_system_info(struct limare_state *state)
+{
+	_mali_uk_get_system_info_size_s system_info_size;
+	_mali_uk_get_system_info_s system_info_ioctl;
+	struct _mali_system_info *system_info;
+	int ret;
+
+	ret = ioctl(state->fd, MALI_IOC_GET_SYSTEM_INFO_SIZE,
+		    &system_info_size);
+	if (ret) {
+		printf("Error: %s: ioctl(GET_SYSTEM_INFO_SIZE) failed: %s\n",
+		       __func__, strerror(ret));
+		return ret;
+	}
+
+	system_info_ioctl.size = system_info_size.size;
+	system_info_ioctl.system_info = calloc(1, system_info_size.size);
+	if (!system_info_ioctl.system_info) {
+		printf("%s: Error: failed to allocate system info: %s\n",
+		       __func__, strerror(errno));
+		return errno;
+	}
+
+	ret = ioctl(state->fd, MALI_IOC_GET_SYSTEM_INFO, &system_info_ioctl);
+	if (ret) {
+		printf("%s: Error: ioctl(GET_SYSTEM_INFO) failed: %s\n",
+		       __func__, strerror(ret));
+		free(system_info_ioctl.system_info);
+		return ret;
+	}
+
+	system_info = system_info_ioctl.system_info;
+
+	if (system_info->mem_info)
+		state->mem_type_id = system_info->mem_info->identifier;
+
+	switch (system_info->core_info->type) {
+	case _MALI_GP2:
+	case _MALI_200:
+		printf("Detected Mali-200.\n");
+		state->type = 200;
+		break;
+	case _MALI_400_GP:
+	case _MALI_400_PP:
+		printf("Detected Mali-400.\n");
+		state->type = 400;
+		break;
+	default:
+		break;
+	}
+
+	return mali_pp_cores_detect(state);
+}
+
+static int
+mali_mem_init(struct limare_state *state, unsigned int *physical)
+{
+	_mali_uk_init_mem_s mem_init = { 0 };
+	int ret;
+
+	mem_init.ctx = (void *) state->fd;
+	mem_init.mali_address_base = 0;
+	mem_init.memory_size = 0;
+	ret = ioctl(state->fd, MALI_IOC_MEM_INIT, &mem_init);
+	if (ret == -1) {
+		printf("Error: ioctl MALI_IOC_MEM_INIT failed: %s\n",
+		       strerror(errno));
+		return errno;
+	}
+
+	*physical = mem_init.mali_address_base;
+
+	return 0;
+}
+
+static void *
+mali_mmap(struct limare_state *state, unsigned int physical, int size)
+{
+	void *address;
+
+	address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       state->fd, physical);
+	if (address == MAP_FAILED) {
+		printf("Error: failed to mmap offset 0x%x (0x%x): %s\n",
+		       physical, size, strerror(errno));
+		return NULL;
+	}
+
+	return address;
+}
+
+static void
+mali_munmap(struct limare_state *state, void *address, int size)
+{
+	munmap(address, size);
+}
+
+static int
+mali_big_block_get(struct limare_state *state, int size,
+		   unsigned int *physical, int *real_size,
+		   unsigned int *cookie)
+{
+	_mali_uk_get_big_block_s get = { 0 };
+	int ret;
+
+	get.ctx = (void *) state->fd;
+	get.type_id = state->mem_type_id;
+	get.minimum_size_requested = size;
+
+	ret = ioctl(state->fd, MALI_IOC_MEM_GET_BIG_BLOCK, &get);
+	if (ret == -1) {
+		printf("%s: Error: ioctl MALI_IOC_MEM_GET_BIG_BLOCK failed: "
+		       "%s\n", __func__, strerror(errno));
+		return errno;
+	}
+
+	*physical = get.mali_address;
+	*real_size = get.memory_size;
+	*cookie = get.cookie;
+
+	return 0;
+}
+
+static void
+mali_big_block_free(struct limare_state *state, unsigned int cookie)
+{
+	_mali_uk_free_big_block_s release = { 0 };
+
+	release.ctx = (void *) state->fd;
+	release.cookie = cookie;
+	if (ioctl(state->fd, MALI_IOC_MEM_FREE_BIG_BLOCK, &release) == -1)
+		printf("%s: Error: ioctl MALI_IOC_MEM_FREE_BIG_BLOCK failed: "
+		       "%s\n", __func__, strerror(errno));
+}
+
+static int
+mali_job_start(struct limare_state *state, unsigned long request, void *job)
+{
+	if (ioctl(state->fd, request, job) == -1)
+		return errno;
+
+	return 0;
+}
+
+static int
+mali_job_abort(struct limare_state *state, int core, unsigned int abort_id)
+{
+	int ret;
+
+	if (core == LIMARE_JOB_GP) {
+		_mali_uk_gp_abort_job_s abort = { 0 };
+
+		abort.ctx = (void *) state->fd;
+		abort.abort_id = abort_id;
+		ret = ioctl(state->fd, MALI_IOC_GP2_ABORT_JOB, &abort);
+	} else {
+		_mali_uk_pp_abort_job_s abort = { 0 };
+
+		abort.ctx = (void *) state->fd;
+		abort.abort_id = abort_id;
+		ret = ioctl(state->fd, MALI_IOC_PP_ABORT_JOB, &abort);
+	}
+
+	if (ret == -1)
+		return errno;
+
+	return 0;
+}
+
+static int
+mali_notification_wait(struct limare_state *state,
+		       _mali_uk_wait_for_notification_s *wait)
+{
+	if (ioctl(state->fd, MALI_IOC_WAIT_FOR_NOTIFICATION, wait) == -1)
+		return errno;
+
+	return 0;
+}
+
+const struct limare_backend limare_backend_mali = {
+	.name = "mali",
+	.open = mali_open,
+	.close = mali_close,
+	.system_info = mali_system_info,
+	.mem_init = mali_mem_init,
+	.mmap = mali_mmap,
+	.munmap = mali_munmap,
+	.big_block_get = mali_big_block_get,
+	.big_block_free = mali_big_block_free,
+	.job_start = mali_job_start,
+	.job_abort = mali_job_abort,
+	.notification_wait = mali_notification_wait,
+};
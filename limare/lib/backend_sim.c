@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Simulated backend, for hosts without a mali: memory comes from anonymous
+ * mappings, and jobs do not get executed, they just finish after a set
+ * latency. This exercises everything up to the kernel interface, so that
+ * the command stream building and job handling can be run and timed.
+ *
+ * Environment:
+ *   LIMARE_SIM_LATENCY: us that each job takes, default 0.
+ *   LIMARE_SIM_PP_CORES: number of pp cores, default 1.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#define u32 uint32_t
+#include "linux/mali_ioctl.h"
+
+#include "linux/ioctl.h"
+#include "limare.h"
+#include "jobs.h"
+#include "backend.h"
+
+/* where our fake gpu memory starts, like on real hardware. */
+#define SIM_MEM_BASE 0x40000000
+#define SIM_MEM_BLOCK_ALIGN 0x100000
+
+#define SIM_PP_CORES_MAX 4
+
+struct sim_notification {
+	long long due; /* us */
+	unsigned int type;
+	unsigned int user_job_ptr;
+	unsigned int status;
+
+	struct sim_notification *next;
+};
+
+struct sim {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	int latency; /* us */
+	int pp_core_count;
+
+	/* when each core is done with what it was given. */
+	long long gp_busy;
+	long long pp_busy[SIM_PP_CORES_MAX];
+
+	/* sorted by due time. */
+	struct sim_notification *notifications;
+
+	unsigned int physical_next;
+};
+
+static long long
+sim_usecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+}
+
+static int
+sim_open(struct limare_state *state)
+{
+	struct sim *sim;
+	char *env;
+
+	sim = calloc(1, sizeof(struct sim));
+	if (!sim) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return errno;
+	}
+
+	pthread_mutex_init(&sim->mutex, NULL);
+	pthread_cond_init(&sim->cond, NULL);
+
+	env = getenv("LIMARE_SIM_LATENCY");
+	if (env)
+		sim->latency = atoi(env);
+
+	sim->pp_core_count = 1;
+	env = getenv("LIMARE_SIM_PP_CORES");
+	if (env)
+		sim->pp_core_count = atoi(env);
+	if (sim->pp_core_count < 1)
+		sim->pp_core_count = 1;
+	if (sim->pp_core_count > SIM_PP_CORES_MAX)
+		sim->pp_core_count = SIM_PP_CORES_MAX;
+
+	sim->physical_next = SIM_MEM_BASE;
+
+	state->backend_private = sim;
+	state->fd = -1;
+
+	printf("Using the simulated backend: %dus per job, %d pp cores.\n",
+	       sim->latency, sim->pp_core_count);
+
+	return 0;
+}
+
+static void
+sim_close(struct limare_state *state)
+{
+	struct sim *sim = state->backend_private;
+
+	if (!sim)
+		return;
+
+	while (sim->notifications) {
+		struct sim_notification *notification = sim->notifications;
+
+		sim->notifications = notification->next;
+		free(notification);
+	}
+
+	pthread_cond_destroy(&sim->cond);
+	pthread_mutex_destroy(&sim->mutex);
+	free(sim);
+
+	state->backend_private = NULL;
+}
+
+static int
+sim_system_info(struct limare_state *state)
+{
+	struct sim *sim = state->backend_private;
+
+	state->type = 400;
+	state->mem_type_id = 0;
+	state->pp_core_count = sim->pp_core_count;
+
+	return 0;
+}
+
+static int
+sim_mem_init(struct limare_state *state, unsigned int *physical)
+{
+	struct sim *sim = state->backend_private;
+
+	pthread_mutex_lock(&sim->mutex);
+	*physical = sim->physical_next;
+	sim->physical_next += SIM_MEM_BLOCK_ALIGN;
+	pthread_mutex_unlock(&sim->mutex);
+
+	return 0;
+}
+
+static void *
+sim_mmap(struct limare_state *state, unsigned int physical, int size)
+{
+	void *address;
+
+	address = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (address == MAP_FAILED) {
+		printf("%s: Error: failed to map 0x%x bytes: %s\n",
+		       __func__, size, strerror(errno));
+		return NULL;
+	}
+
+	return address;
+}
+
+static void
+sim_munmap(struct limare_state *state, void *address, int size)
+{
+	munmap(address, size);
+}
+
+static int
+sim_big_block_get(struct limare_state *state, int size,
+		  unsigned int *physical, int *real_size,
+		  unsigned int *cookie)
+{
+	struct sim *sim = state->backend_private;
+
+	size = ALIGN(size, SIM_MEM_BLOCK_ALIGN);
+
+	pthread_mutex_lock(&sim->mutex);
+	*physical = sim->physical_next;
+	sim->physical_next += size;
+	pthread_mutex_unlock(&sim->mutex);
+
+	*real_size = size;
+	*cookie = *physical;
+
+	return 0;
+}
+
+static void
+sim_big_block_free(struct limare_state *state, unsigned int cookie)
+{
+}
+
+/*
+ * Called with the mutex held.
+ */
+static void
+sim_notification_add(struct sim *sim, struct sim_notification *notification)
+{
+	struct sim_notification **link = &sim->notifications;
+
+	while (*link && ((*link)->due <= notification->due))
+		link = &(*link)->next;
+
+	notification->next = *link;
+	*link = notification;
+
+	pthread_cond_broadcast(&sim->cond);
+}
+
+/*
+ * Jobs run back to back on each core, and the pp job goes to whichever
+ * pp core frees up first.
+ */
+static int
+sim_job_start(struct limare_state *state, unsigned long request, void *job)
+{
+	struct sim *sim = state->backend_private;
+	struct sim_notification *notification;
+	long long now = sim_usecs(), *busy;
+	int i;
+
+	notification = calloc(1, sizeof(struct sim_notification));
+	if (!notification)
+		return ENOMEM;
+
+	notification->status = _MALI_UK_JOB_STATUS_END_SUCCESS;
+
+	if (request == LIMA_GP_START_JOB) {
+		struct lima_gp_job_start *gp = job;
+
+		gp->status = JOB_STARTED;
+		notification->type = _MALI_NOTIFICATION_GP_FINISHED;
+		notification->user_job_ptr = gp->user_job_ptr;
+	} else if (request == LIMA_M200_PP_START_JOB) {
+		struct lima_m200_pp_job_start *pp = job;
+
+		pp->status = JOB_STARTED;
+		notification->type = _MALI_NOTIFICATION_PP_FINISHED;
+		notification->user_job_ptr = pp->user_job_ptr;
+	} else if (request == LIMA_M400_PP_START_JOB) {
+		struct lima_m400_pp_job_start *pp = job;
+
+		pp->status = JOB_STARTED;
+		notification->type = _MALI_NOTIFICATION_PP_FINISHED;
+		notification->user_job_ptr = pp->user_job_ptr;
+	} else {
+		free(notification);
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&sim->mutex);
+
+	if (notification->type == _MALI_NOTIFICATION_GP_FINISHED)
+		busy = &sim->gp_busy;
+	else {
+		busy = &sim->pp_busy[0];
+		for (i = 1; i < sim->pp_core_count; i++)
+			if (sim->pp_busy[i] < *busy)
+				busy = &sim->pp_busy[i];
+	}
+
+	if (*busy < now)
+		*busy = now;
+	*busy += sim->latency;
+	notification->due = *busy;
+
+	sim_notification_add(sim, notification);
+
+	pthread_mutex_unlock(&sim->mutex);
+
+	return 0;
+}
+
+/*
+ * Our abort id is the user_job_ptr, so the job finishes right away.
+ */
+static int
+sim_job_abort(struct limare_state *state, int core, unsigned int abort_id)
+{
+	struct sim *sim = state->backend_private;
+	struct sim_notification **link, *notification = NULL;
+
+	pthread_mutex_lock(&sim->mutex);
+
+	for (link = &sim->notifications; *link; link = &(*link)->next)
+		if ((*link)->user_job_ptr == abort_id) {
+			notification = *link;
+			*link = notification->next;
+			break;
+		}
+
+	if (notification) {
+		notification->status = _MALI_UK_JOB_STATUS_END_ABORT;
+		notification->due = sim_usecs();
+		sim_notification_add(sim, notification);
+	}
+
+	pthread_mutex_unlock(&sim->mutex);
+
+	return 0;
+}
+
+static int
+sim_notification_wait(struct limare_state *state,
+		      _mali_uk_wait_for_notification_s *wait)
+{
+	struct sim *sim = state->backend_private;
+	struct sim_notification *notification;
+	long long now, end, until;
+	struct timespec timeout;
+
+	now = sim_usecs();
+	end = now + wait->code.timeout * 1000LL;
+
+	pthread_mutex_lock(&sim->mutex);
+
+	while (1) {
+		notification = sim->notifications;
+		if (notification && (notification->due <= now))
+			break;
+
+		if (now >= end) {
+			pthread_mutex_unlock(&sim->mutex);
+			wait->code.type = _MALI_NOTIFICATION_CORE_TIMEOUT;
+			return 0;
+		}
+
+		until = end;
+		if (notification && (notification->due < until))
+			until = notification->due;
+
+		/* the condition uses the realtime clock. */
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		until = (timeout.tv_sec * 1000000LL) +
+			(timeout.tv_nsec / 1000) + (until - now);
+		timeout.tv_sec = until / 1000000;
+		timeout.tv_nsec = (until % 1000000) * 1000;
+
+		pthread_cond_timedwait(&sim->cond, &sim->mutex, &timeout);
+
+		now = sim_usecs();
+	}
+
+	sim->notifications = notification->next;
+
+	pthread_mutex_unlock(&sim->mutex);
+
+	wait->code.type = notification->type;
+	if (notification->type == _MALI_NOTIFICATION_GP_FINISHED) {
+		wait->data.gp_job_finished.user_job_ptr =
+			notification->user_job_ptr;
+		wait->data.gp_job_finished.status = notification->status;
+	} else {
+		wait->data.pp_job_finished.user_job_ptr =
+			notification->user_job_ptr;
+		wait->data.pp_job_finished.status = notification->status;
+	}
+
+	free(notification);
+
+	return 0;
+}
+
+const struct limare_backend limare_backend_sim = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.system_info = sim_system_info,
+	.mem_init = sim_mem_init,
+	.mmap = sim_mmap,
+	.munmap = sim_munmap,
+	.big_block_get = sim_big_block_get,
+	.big_block_free = sim_big_block_free,
+	.job_start = sim_job_start,
+	.job_abort = sim_job_abort,
+	.notification_wait = sim_notification_wait,
+};
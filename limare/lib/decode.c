@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Walks the vs and plbu command streams of a gp job, the way the gp would,
+ * and collects what each draw makes the hardware fetch and set up. Only the
+ * commands that we emit ourselves are understood; anything else is counted
+ * as unknown.
+ *
+ * The vs and plbu streams both hold one semaphore delimited block per draw,
+ * in the same order, so the nth block of either belongs to the same draw.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "limare.h"
+#include "linux/ioctl.h"
+#include "symbols.h"
+#include "gp.h"
+#include "vs.h"
+#include "plbu.h"
+#include "render_state.h"
+#include "mem.h"
+#include "plb.h"
+#include "decode.h"
+
+struct decode *
+decode_create(void)
+{
+	struct decode *decode = calloc(1, sizeof(struct decode));
+
+	if (!decode) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	return decode;
+}
+
+void
+decode_destroy(struct decode *decode)
+{
+	free(decode->draws);
+	free(decode);
+}
+
+static struct decode_draw *
+decode_draw_get(struct decode *decode, int index)
+{
+	if (index >= decode->draw_size) {
+		struct decode_draw *draws;
+		int size = decode->draw_size ? 2 * decode->draw_size : 64;
+
+		while (size <= index)
+			size *= 2;
+
+		draws = realloc(decode->draws, size * sizeof(struct decode_draw));
+		if (!draws) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			return NULL;
+		}
+
+		decode->draws = draws;
+		decode->draw_size = size;
+	}
+
+	while (decode->draw_count <= index) {
+		memset(&decode->draws[decode->draw_count], 0,
+		       sizeof(struct decode_draw));
+		decode->draw_count++;
+	}
+
+	return &decode->draws[index];
+}
+
+/*
+ * Returns 1 when the register did not hold this value already.
+ */
+static int
+decode_register_set(struct decode_registers *registers, unsigned int key,
+		    unsigned int cmd, unsigned int val)
+{
+	int i;
+
+	for (i = 0; i < registers->count; i++)
+		if (registers->key[i] == key)
+			break;
+
+	if (i == registers->count) {
+		if (i == DECODE_REGISTERS_MAX)
+			return 1;
+		registers->key[i] = key;
+		registers->count++;
+	} else if ((registers->cmd[i] == cmd) && (registers->val[i] == val))
+		return 0;
+
+	registers->cmd[i] = cmd;
+	registers->val[i] = val;
+
+	return 1;
+}
+
+static struct lima_cmd *
+decode_stream_get(struct limare_state *state, unsigned int start,
+		  unsigned int end, int *count)
+{
+	struct lima_cmd *cmds;
+
+	if ((end < start) || ((end - start) & 0x07)) {
+		printf("%s: Error: invalid stream 0x%08x - 0x%08x\n",
+		       __func__, start, end);
+		return NULL;
+	}
+
+	cmds = limare_mem_address(state, start, end - start);
+	if (!cmds) {
+		printf("%s: Error: stream 0x%08x - 0x%08x is not ours\n",
+		       __func__, start, end);
+		return NULL;
+	}
+
+	*count = (end - start) / 8;
+	return cmds;
+}
+
+/*
+ * Bytes which the vertex shader streams through for all vertices, given
+ * a table of attribute or varying entries.
+ */
+static int
+decode_vs_table_bytes(struct limare_state *state, struct decode *decode,
+		      struct gp_common_entry *table, int count,
+		      int vertex_count)
+{
+	int i, bytes = 0;
+
+	if (!table) {
+		decode->errors++;
+		return 0;
+	}
+
+	for (i = 0; i < count; i++)
+		bytes += (((unsigned int) table[i].size >> 11) & 0x7FF) *
+			vertex_count;
+
+	return bytes;
+}
+
+struct decode_vs_context {
+	unsigned int common_physical; /* m200 */
+	unsigned int attributes_physical; /* m400 */
+	unsigned int varyings_physical; /* m400 */
+	int attribute_count;
+	int varying_count;
+	int uniform_bytes;
+};
+
+static void
+decode_vs_draw(struct limare_state *state, struct decode *decode,
+	       struct decode_vs_context *context, struct decode_draw *draw,
+	       struct lima_cmd *cmd)
+{
+	struct gp_common_entry *attributes = NULL, *varyings = NULL;
+
+	draw->vertex_count = (cmd->val >> 24) | ((cmd->cmd & 0xFFFF) << 8);
+	draw->attribute_count = context->attribute_count;
+	draw->varying_count = context->varying_count;
+	draw->uniform_bytes += context->uniform_bytes;
+
+	if (state->type == LIMARE_TYPE_M200) {
+		struct gp_common *common =
+			limare_mem_address(state, context->common_physical,
+					   sizeof(struct gp_common));
+
+		if (common) {
+			attributes = common->attributes;
+			varyings = common->varyings;
+		}
+
+		draw->varyings_physical = context->common_physical +
+			offsetof(struct gp_common, varyings);
+	} else {
+		int size = 0x10 * sizeof(struct gp_common_entry);
+
+		attributes = limare_mem_address(state,
+						context->attributes_physical,
+						size);
+		varyings = limare_mem_address(state,
+					      context->varyings_physical,
+					      size);
+
+		draw->varyings_physical = context->varyings_physical;
+	}
+
+	draw->attribute_bytes =
+		decode_vs_table_bytes(state, decode, attributes,
+				      draw->attribute_count,
+				      draw->vertex_count);
+	draw->varying_bytes =
+		decode_vs_table_bytes(state, decode, varyings,
+				      draw->varying_count,
+				      draw->vertex_count);
+}
+
+static void
+decode_vs(struct limare_state *state, struct decode *decode,
+	  struct lima_cmd *cmds, int count)
+{
+	struct decode_vs_context context[1] = {{ 0 }};
+	struct decode_draw *draw = NULL;
+	int i, index = 0;
+
+	for (i = 0; i < count; i++) {
+		struct lima_cmd *cmd = &cmds[i];
+		unsigned int key = 0;
+
+		switch (cmd->cmd >> 28) {
+		case 0x0:
+			if (!draw)
+				decode->errors++;
+			else
+				decode_vs_draw(state, decode, context,
+					       draw, cmd);
+			continue;
+		case 0x1:
+			if (cmd->cmd == LIMA_VS_CMD_VARYING_ATTRIBUTE_COUNT) {
+				context->attribute_count =
+					((cmd->val >> 24) & 0xFF) + 1;
+				context->varying_count =
+					((cmd->val >> 8) & 0xFF) + 1;
+			}
+			key = cmd->cmd;
+			break;
+		case 0x2:
+			if ((cmd->cmd & 0x0F) == 0x08)
+				context->varyings_physical = cmd->val;
+			else if (state->type == LIMARE_TYPE_M200)
+				context->common_physical = cmd->val;
+			else
+				context->attributes_physical = cmd->val;
+			key = cmd->cmd & 0xF000000F;
+			break;
+		case 0x3:
+			context->uniform_bytes =
+				4 * ((cmd->cmd >> 14) & 0x3FFF);
+			key = cmd->cmd & 0xF0000000;
+			break;
+		case 0x4:
+			key = cmd->cmd & 0xF0000000;
+			break;
+		case 0x5:
+			if (cmd->val == LIMA_VS_CMD_ARRAYS_SEMAPHORE_BEGIN_1) {
+				draw = decode_draw_get(decode, index);
+				if (!draw)
+					return;
+			} else if (cmd->val == LIMA_VS_CMD_ARRAYS_SEMAPHORE_END) {
+				draw = NULL;
+				index++;
+			}
+			continue;
+		case 0x6: /* flush */
+			continue;
+		default:
+			decode->unknown_commands++;
+			continue;
+		}
+
+		if (!draw) {
+			decode->setup_commands++;
+			decode_register_set(&decode->vs_registers, key,
+					    cmd->cmd, cmd->val);
+			continue;
+		}
+
+		draw->state_commands++;
+		draw->state_changes +=
+			decode_register_set(&decode->vs_registers, key,
+					    cmd->cmd, cmd->val);
+	}
+}
+
+/*
+ * Fragment uniforms are half floats, found through the render state.
+ */
+static int
+decode_fragment_uniform_bytes(struct limare_state *state,
+			      struct decode *decode, unsigned int physical)
+{
+	struct render_state *render_state;
+
+	render_state = limare_mem_address(state, physical,
+					  sizeof(struct render_state));
+	if (!render_state) {
+		decode->errors++;
+		return 0;
+	}
+
+	if (!(render_state->unknown34 & 0x80))
+		return 0;
+
+	return 8 * ((render_state->uniforms_address & 0x3F) + 1);
+}
+
+/*
+ * The setup before the draws tells us where the plb blocks are.
+ */
+static void
+decode_plbu_setup(struct decode *decode, struct lima_cmd *cmd)
+{
+	struct decode_plb *plb = &decode->plb;
+
+	if (cmd->cmd == LIMA_PLBU_CMD_BLOCK_STEP) {
+		plb->shift_w = cmd->val & 0xFF;
+		plb->shift_h = (cmd->val >> 16) & 0xFF;
+	} else if (cmd->cmd == LIMA_PLBU_CMD_TILED_DIMENSIONS) {
+		plb->tiles_w = (cmd->val >> 24) + 1;
+		plb->tiles_h = ((cmd->val >> 8) & 0xFFFF) + 1;
+	} else if ((cmd->cmd & 0xF0000000) ==
+		   LIMA_PLBU_CMD_PLBU_BLOCK_STRIDE)
+		plb->block_stride = cmd->val;
+	else if (((cmd->cmd & 0xFF000000) ==
+		  LIMA_M200_PLBU_CMD_PLBU_ARRAY_ADDRESS) ||
+		 ((cmd->cmd & 0xFF000000) ==
+		  LIMA_M400_PLBU_CMD_PLBU_ARRAY_ADDRESS))
+		plb->array_physical = cmd->val;
+}
+
+static void
+decode_plbu(struct limare_state *state, struct decode *decode,
+	    struct lima_cmd *cmds, int count)
+{
+	struct decode_draw *draw = NULL;
+	unsigned int render_state = 0;
+	int i, index = 0;
+
+	for (i = 0; i < count; i++) {
+		struct lima_cmd *cmd = &cmds[i];
+		unsigned int key = 0;
+		int vertex_count;
+
+		switch (cmd->cmd >> 28) {
+		case 0x0:
+			if (!draw) {
+				decode->errors++;
+				continue;
+			}
+
+			vertex_count = (cmd->val >> 24) |
+				((cmd->cmd & 0xFFFF) << 8);
+			if (draw->vertex_count &&
+			    (draw->vertex_count != vertex_count)) {
+				printf("%s: Error: draw %d: vs has %d vertices,"
+				       " plbu %d\n", __func__, index,
+				       draw->vertex_count, vertex_count);
+				decode->errors++;
+			}
+
+			draw->draw_mode = (cmd->cmd >> 16) & 0x1F;
+			draw->vertex_count = vertex_count;
+			draw->render_state_physical = render_state;
+			draw->uniform_bytes +=
+				decode_fragment_uniform_bytes(state, decode,
+							      render_state);
+			continue;
+		case 0x1:
+			key = cmd->cmd;
+			break;
+		case 0x2:
+			key = cmd->cmd & 0xFF000000;
+			break;
+		case 0x3:
+			key = cmd->cmd & 0xF0000000;
+			break;
+		case 0x5:
+			if (cmd->cmd == LIMA_PLBU_CMD_END)
+				return;
+			decode->unknown_commands++;
+			continue;
+		case 0x6:
+			if (cmd->val == LIMA_PLBU_CMD_ARRAYS_SEMAPHORE_BEGIN) {
+				draw = decode_draw_get(decode, index);
+				if (!draw)
+					return;
+			} else if (cmd->val ==
+				   LIMA_PLBU_CMD_ARRAYS_SEMAPHORE_END) {
+				draw = NULL;
+				index++;
+			}
+			continue;
+		case 0x8:
+			render_state = cmd->val;
+			key = cmd->cmd & 0xF0000000;
+			break;
+		case 0xD: /* flush */
+			continue;
+		default:
+			decode->unknown_commands++;
+			continue;
+		}
+
+		if (!draw) {
+			decode->setup_commands++;
+			decode_plbu_setup(decode, cmd);
+			decode_register_set(&decode->plbu_registers, key,
+					    cmd->cmd, cmd->val);
+			continue;
+		}
+
+		draw->state_commands++;
+		draw->state_changes +=
+			decode_register_set(&decode->plbu_registers, key,
+					    cmd->cmd, cmd->val);
+	}
+}
+
+/*
+ * Decodes a gp job, after the draw statistics of the previous one. The
+ * registers start out unknown for every job.
+ */
+int
+decode_gp_job(struct limare_state *state, struct decode *decode,
+	      struct lima_gp_frame_registers *frame)
+{
+	struct lima_cmd *vs_cmds, *plbu_cmds;
+	int vs_count, plbu_count, i;
+
+	vs_cmds = decode_stream_get(state, frame->vs_commands_start,
+				    frame->vs_commands_end, &vs_count);
+	if (!vs_cmds)
+		return -1;
+
+	plbu_cmds = decode_stream_get(state, frame->plbu_commands_start,
+				      frame->plbu_commands_end, &plbu_count);
+	if (!plbu_cmds)
+		return -1;
+
+	decode->draw_count = 0;
+	decode->vs_commands = vs_count;
+	decode->plbu_commands = plbu_count;
+	decode->setup_commands = 0;
+	decode->unknown_commands = 0;
+	decode->errors = 0;
+
+	memset(&decode->vs_registers, 0, sizeof(struct decode_registers));
+	memset(&decode->plbu_registers, 0, sizeof(struct decode_registers));
+	memset(&decode->plb, 0, sizeof(struct decode_plb));
+
+	decode_vs(state, decode, vs_cmds, vs_count);
+	decode_plbu(state, decode, plbu_cmds, plbu_count);
+
+	decode->job_count++;
+	decode->total_draws += decode->draw_count;
+	decode->total_vs_commands += vs_count;
+	decode->total_plbu_commands += plbu_count;
+
+	for (i = 0; i < decode->draw_count; i++) {
+		struct decode_draw *draw = &decode->draws[i];
+
+		decode->total.vertex_count += draw->vertex_count;
+		decode->total.attribute_bytes += draw->attribute_bytes;
+		decode->total.varying_bytes += draw->varying_bytes;
+		decode->total.uniform_bytes += draw->uniform_bytes;
+		decode->total.state_commands += draw->state_commands;
+		decode->total.state_changes += draw->state_changes;
+	}
+
+	if (decode->errors)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The pp jobs of a frame get started after its gp job, each on its own
+ * stream of tiles.
+ */
+void
+decode_pp_stream(struct decode *decode, unsigned int physical)
+{
+	struct decode_plb *plb = &decode->plb;
+
+	if (plb->pp_stream_count == PLB_PP_STREAMS_MAX) {
+		decode->errors++;
+		return;
+	}
+
+	plb->pp_streams[plb->pp_stream_count++] = physical;
+}
+
+static void
+decode_draw_print(const char *name, struct decode_draw *draw)
+{
+	printf("%s: %d vertices, %d bytes attributes, %d bytes varyings, "
+	       "%d bytes uniforms, %d state words (%d changes)\n", name,
+	       draw->vertex_count, draw->attribute_bytes, draw->varying_bytes,
+	       draw->uniform_bytes, draw->state_commands,
+	       draw->state_changes);
+}
+
+/*
+ * Prints the totals, and with draws set, each draw of the last job.
+ */
+void
+decode_print(struct decode *decode, int draws)
+{
+	int i;
+
+	printf("GP command streams: %d jobs, %d draws, %d vs and %d plbu "
+	       "commands.\n", decode->job_count, decode->total_draws,
+	       decode->total_vs_commands, decode->total_plbu_commands);
+	decode_draw_print("Total", &decode->total);
+
+	if (!draws)
+		return;
+
+	printf("Last job: %d vs and %d plbu commands, %d plbu setup, "
+	       "%d unknown, %d errors.\n", decode->vs_commands,
+	       decode->plbu_commands, decode->setup_commands,
+	       decode->unknown_commands, decode->errors);
+
+	for (i = 0; i < decode->draw_count; i++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "Draw %d", i);
+		decode_draw_print(name, &decode->draws[i]);
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Software walk of the gp command streams, to see what a frame costs
+ * without needing the hardware.
+ */
+
+#ifndef LIMARE_DECODE_H
+#define LIMARE_DECODE_H 1
+
+struct decode_draw {
+	int draw_mode;
+	int vertex_count;
+
+	int attribute_count;
+	int varying_count;
+
+	int attribute_bytes; /* read by the vertex shader */
+	int varying_bytes; /* written by the vertex shader */
+	int uniform_bytes; /* vertex and fragment */
+
+	int state_commands; /* state setting words emitted for this draw */
+	int state_changes; /* those which did not repeat the current value */
+
+	/* where the gp outputs and the pp state of this draw live. */
+	unsigned int varyings_physical; /* table of gp_common_entry */
+	unsigned int render_state_physical;
+};
+
+/*
+ * The plb layout of the last decoded frame, as set up in its plbu stream,
+ * and the pp streams which were started on it.
+ */
+struct decode_plb {
+	int shift_w; /* tiles per block, as a shift */
+	int shift_h;
+	int tiles_w;
+	int tiles_h;
+	int block_stride; /* blocks per row */
+	unsigned int array_physical; /* plb block address, for each block */
+
+	unsigned int pp_streams[PLB_PP_STREAMS_MAX];
+	int pp_stream_count;
+};
+
+/* state registers we keep track of, per stream. */
+#define DECODE_REGISTERS_MAX 32
+
+struct decode_registers {
+	unsigned int key[DECODE_REGISTERS_MAX];
+	unsigned int cmd[DECODE_REGISTERS_MAX];
+	unsigned int val[DECODE_REGISTERS_MAX];
+	int count;
+};
+
+struct decode {
+	/* draws of the last decoded job. */
+	struct decode_draw *draws;
+	int draw_count;
+	int draw_size;
+
+	/* last decoded job. */
+	int vs_commands;
+	int plbu_commands;
+	int setup_commands; /* plbu words outside of draws */
+	int unknown_commands;
+	int errors;
+
+	struct decode_plb plb;
+
+	/* everything decoded so far. */
+	int job_count;
+	int total_draws;
+	int total_vs_commands;
+	int total_plbu_commands;
+	struct decode_draw total;
+
+	struct decode_registers vs_registers;
+	struct decode_registers plbu_registers;
+};
+
+struct decode *decode_create(void);
+void decode_destroy(struct decode *decode);
+
+struct lima_gp_frame_registers;
+int decode_gp_job(struct limare_state *state, struct decode *decode,
+		  struct lima_gp_frame_registers *frame);
+
+void decode_pp_stream(struct decode *decode, unsigned int physical);
+
+void decode_print(struct decode *decode, int draws);
+
+#endif /* LIMARE_DECODE_H */
@@ -43,31 +43,63 @@
 #include "plbu.h"
 #include "render_state.h"
 #include "hfloat.h"
+#include "mem.h"
+#include "uniforms.h"
+#include "arena.h"
+#include "compiler.h"
+#include "decode.h"
 
 int
-vs_command_queue_create(struct limare_state *state, int offset, int size)
+vs_command_queue_create(struct limare_state *state, int size)
 {
-	state->vs_commands = state->mem_address + offset;
-	state->vs_commands_physical = state->mem_physical + offset;
-	state->vs_commands_count = 0;
+	state->vs_commands =
+		limare_mem_alloc(state, size, MEM_ALIGN_DEFAULT,
+				 &state->vs_commands_physical);
+	if (!state->vs_commands)
+		return -1;
+
 	state->vs_commands_size = size / 8;
 
+	vs_commands_start(state);
+
 	return 0;
 }
 
 int
-plbu_command_queue_create(struct limare_state *state, int offset, int size)
+plbu_command_queue_create(struct limare_state *state, int size)
 {
-	struct plb *plb = state->plb;
-	struct lima_cmd *cmds;
-	int i = 0;
+	state->plbu_commands =
+		limare_mem_alloc(state, size, MEM_ALIGN_DEFAULT,
+				 &state->plbu_commands_physical);
+	if (!state->plbu_commands)
+		return -1;
 
-	state->plbu_commands = state->mem_address + offset;
-	state->plbu_commands_physical = state->mem_physical + offset;
-	state->plbu_commands_count = 0;
 	state->plbu_commands_size = size / 8;
 
-	cmds = state->plbu_commands;
+	plbu_commands_start(state);
+
+	return 0;
+}
+
+/*
+ * (Re-)start the vs command queue, for a new frame.
+ */
+void
+vs_commands_start(struct limare_state *state)
+{
+	state->vs_commands_count = 0;
+}
+
+/*
+ * (Re-)start the plbu command queue, for a new frame. Emits the setup that
+ * comes before all draws.
+ */
+void
+plbu_commands_start(struct limare_state *state)
+{
+	struct plb *plb = state->plb;
+	struct lima_cmd *cmds = state->plbu_commands;
+	int i = 0;
 
 	cmds[i].val = plb->shift_w | (plb->shift_h << 16);
 	if (state->type == LIMARE_TYPE_M400) {
@@ -143,6 +175,106 @@ plbu_command_queue_create(struct limare_state *state, int offset, int size)
 	i++;
 
 	state->plbu_commands_count = i;
+}
+
+/*
+ * Command queues are only handed to the gp on flush, so when they run out
+ * of space, we can simply move them to a larger buffer.
+ */
+static struct lima_cmd *
+command_queue_grow(struct limare_state *state, struct lima_cmd *cmds,
+		   unsigned int *physical, int count, int *size)
+{
+	struct lima_cmd *new;
+	unsigned int new_physical;
+	int new_size = 2 * *size;
+
+	new = limare_mem_alloc(state, 8 * new_size, MEM_ALIGN_DEFAULT,
+			       &new_physical);
+	if (!new)
+		return NULL;
+
+	memcpy(new, cmds, 8 * count);
+	limare_mem_free(state, *physical);
+
+	state->stats.bytes_copied += 8 * count;
+
+	*physical = new_physical;
+	*size = new_size;
+
+	return new;
+}
+
+static int
+vs_commands_reserve(struct limare_state *state, int count)
+{
+	struct lima_cmd *cmds;
+
+	if ((state->vs_commands_count + count) <= state->vs_commands_size)
+		return 0;
+
+	cmds = command_queue_grow(state, state->vs_commands,
+				  &state->vs_commands_physical,
+				  state->vs_commands_count,
+				  &state->vs_commands_size);
+	if (!cmds) {
+		printf("%s: Error: vs command queue is full (%d)\n",
+		       __func__, state->vs_commands_size);
+		return -1;
+	}
+
+	state->vs_commands = cmds;
+	return 0;
+}
+
+static int
+plbu_commands_reserve(struct limare_state *state, int count)
+{
+	struct lima_cmd *cmds;
+
+	if ((state->plbu_commands_count + count) <= state->plbu_commands_size)
+		return 0;
+
+	cmds = command_queue_grow(state, state->plbu_commands,
+				  &state->plbu_commands_physical,
+				  state->plbu_commands_count,
+				  &state->plbu_commands_size);
+	if (!cmds) {
+		printf("%s: Error: plbu command queue is full (%d)\n",
+		       __func__, state->plbu_commands_size);
+		return -1;
+	}
+
+	state->plbu_commands = cmds;
+	return 0;
+}
+
+/*
+ * For replaying recorded draws.
+ */
+int
+vs_commands_append(struct limare_state *state, struct lima_cmd *cmds,
+		   int count)
+{
+	if (vs_commands_reserve(state, count))
+		return -1;
+
+	memcpy(&state->vs_commands[state->vs_commands_count], cmds, 8 * count);
+	state->vs_commands_count += count;
+
+	return 0;
+}
+
+int
+plbu_commands_append(struct limare_state *state, struct lima_cmd *cmds,
+		     int count)
+{
+	if (plbu_commands_reserve(state, count))
+		return -1;
+
+	memcpy(&state->plbu_commands[state->plbu_commands_count], cmds,
+	       8 * count);
+	state->plbu_commands_count += count;
 
 	return 0;
 }
@@ -182,39 +314,101 @@ vs_info_setup(struct limare_state *state, struct draw_info *draw)
 	}
 }
 
+/*
+ * Uniforms are packed on the host first, so that identical blocks only
+ * end up in the frame memory once.
+ */
+static int
+uniform_block_get(struct limare_state *state, int type, void *data, int size,
+		  unsigned int *physical)
+{
+	struct mem_ring *ring = state->draw_ring;
+	unsigned int hash;
+	void *address;
+	int offset, header = 0;
+
+	/* recorded blocks get patched later on, so they cannot be shared. */
+	hash = uniform_block_hash(type, data, size);
+	if (!state->recording &&
+	    uniform_cache_lookup(state->uniform_cache, hash, type,
+				 data, size, physical))
+		return 0;
+
+	/* fragment uniforms are found through a single entry array. */
+	if (type == UNIFORM_BLOCK_FRAGMENT)
+		header = 0x40;
+
+	offset = mem_ring_alloc(ring, header + ALIGN(size, 0x40),
+				MEM_ALIGN_DEFAULT);
+	if (offset < 0) {
+		printf("%s: Error: no more space for uniforms\n", __func__);
+		return -1;
+	}
+
+	address = ring->address + offset;
+	*physical = ring->physical + offset;
+
+	if (header)
+		*((unsigned int *) address) = *physical + header;
+	memcpy(address + header, data, size);
+
+	state->stats.allocations++;
+	state->stats.bytes_copied += size;
+
+	/* failing here only means that this block will not be shared. */
+	if (!state->recording)
+		uniform_cache_insert(state->uniform_cache, hash, type,
+				     data, size, *physical);
+
+	return 0;
+}
+
+/*
+ * Packs a single uniform into its place in the block. Returns how many
+ * bytes were written there, from component_size * offset onwards.
+ */
+int
+vs_uniform_pack(void *block, struct symbol *symbol)
+{
+	void *address = block + symbol->component_size * symbol->offset;
+	int j;
+
+	if (symbol->src_stride == symbol->dst_stride) {
+		memcpy(address, symbol->data, symbol->size);
+		return symbol->size;
+	}
+
+	for (j = 0; (j * symbol->src_stride) < symbol->size; j++)
+		memcpy(address + (j * symbol->dst_stride),
+		       symbol->data + (j * symbol->src_stride),
+		       symbol->src_stride);
+
+	if (!j)
+		return 0;
+
+	return ((j - 1) * symbol->dst_stride) + symbol->src_stride;
+}
+
 int
-vs_info_attach_uniforms(struct draw_info *draw, struct symbol **uniforms,
-			int count, int size)
+vs_info_attach_uniforms(struct limare_state *state, struct draw_info *draw,
+			struct symbol **uniforms, int count, int size)
 {
 	struct vs_info *info = draw->vs;
 	void *address;
 	int i;
 
-	info->uniform_offset = draw->mem_used;
 	info->uniform_size = size;
-	draw->mem_used += ALIGN(4 * size, 0x40);
 
-	address = draw->mem_address + info->uniform_offset;
-
-	for (i = 0; i < count; i++) {
-		struct symbol *symbol = uniforms[i];
-
-		if (symbol->src_stride == symbol->dst_stride)
-			memcpy(address + symbol->component_size * symbol->offset,
-			       symbol->data, symbol->size);
-		else {
-			void *symbol_address = address +
-				symbol->component_size * symbol->offset;
-			int j;
+	address = uniform_cache_scratch(state->uniform_cache, 4 * size);
+	if (!address)
+		return -1;
 
-			for (j = 0; (j * symbol->src_stride) < symbol->size; j++)
-				memcpy(symbol_address + (j * symbol->dst_stride),
-				       symbol->data + (j * symbol->src_stride),
-				       symbol->src_stride);
-		}
-	}
+	for (i = 0; i < count; i++)
+		state->stats.bytes_copied +=
+			vs_uniform_pack(address, uniforms[i]);
 
-	return 0;
+	return uniform_block_get(state, UNIFORM_BLOCK_VERTEX, address,
+				 4 * size, &info->uniform_physical);
 }
 
 int
@@ -228,6 +422,16 @@ vs_info_attach_attribute(struct draw_info *draw, struct symbol *attribute)
 		return -1;
 	}
 
+	/* already in gpu memory, just point the gp at it. */
+	if (attribute->data_physical) {
+		attribute->address = attribute->data;
+		attribute->physical = attribute->data_physical;
+
+		info->attributes[attribute->offset / 4] = attribute;
+		info->attribute_count++;
+		return 0;
+	}
+
 	size = ALIGN(attribute->size, 0x40);
 	if (size > (draw->mem_size - draw->mem_used)) {
 		printf("%s: No more space\n", __func__);
@@ -270,39 +474,39 @@ vs_info_attach_varying(struct draw_info *draw, struct symbol *varying)
 	return 0;
 }
 
+/*
+ * The shader is uploaded once, at link time, all draws share that copy.
+ */
 int
-vs_info_attach_shader(struct draw_info *draw, unsigned int *shader, int size)
+vs_info_attach_shader(struct draw_info *draw, unsigned int *shader,
+		     unsigned int physical, int size)
 {
 	struct vs_info *info = draw->vs;
-	int mem_size;
 
 	if (info->shader != NULL) {
 		printf("%s: shader already assigned\n", __func__);
 		return -1;
 	}
 
-	mem_size = ALIGN(size * 16, 0x40);
-	if (mem_size > (draw->mem_size - draw->mem_used)) {
-		printf("%s: no more space\n", __func__);
-		return -2;
-	}
-
-	info->shader = draw->mem_address + draw->mem_used;
-	info->shader_offset = draw->mem_used;
+	info->shader = shader;
+	info->shader_physical = physical;
 	info->shader_size = size;
-	draw->mem_used += mem_size;
-
-	memcpy(info->shader, shader, 16 * size);
 
 	return 0;
 }
 
-void
+int
 vs_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 {
 	struct vs_info *vs = draw->vs;
-	struct lima_cmd *cmds = state->vs_commands;
-	int i = state->vs_commands_count;
+	struct lima_cmd *cmds;
+	int i;
+
+	if (vs_commands_reserve(state, 12))
+		return -1;
+
+	cmds = state->vs_commands;
+	i = state->vs_commands_count;
 
 	cmds[i].val = LIMA_VS_CMD_ARRAYS_SEMAPHORE_BEGIN_1;
 	cmds[i].cmd = LIMA_VS_CMD_ARRAYS_SEMAPHORE;
@@ -312,7 +516,7 @@ vs_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 	cmds[i].cmd = LIMA_VS_CMD_ARRAYS_SEMAPHORE;
 	i++;
 
-	cmds[i].val = draw->mem_physical + vs->shader_offset;
+	cmds[i].val = vs->shader_physical;
 	cmds[i].cmd = LIMA_VS_CMD_SHADER_ADDRESS | (vs->shader_size << 16);
 	i++;
 
@@ -325,7 +529,7 @@ vs_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 	cmds[i].cmd = LIMA_VS_CMD_VARYING_ATTRIBUTE_COUNT;
 	i++;
 
-	cmds[i].val = draw->mem_physical + vs->uniform_offset;
+	cmds[i].val = vs->uniform_physical;
 	cmds[i].cmd = LIMA_VS_CMD_UNIFORMS_ADDRESS |
 		(ALIGN(vs->uniform_size, 4) << 14);
 	i++;
@@ -352,7 +556,7 @@ vs_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 	i++;
 
 	cmds[i].val = (draw->vertex_count << 24);
-	cmds[i].cmd = 0x00000000;
+	cmds[i].cmd = draw->vertex_count >> 8;
 	i++;
 
 	cmds[i].val = 0x00000000;
@@ -365,6 +569,8 @@ vs_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 
 	/* update our size so we can set the gp job properly */
 	state->vs_commands_count = i;
+
+	return 0;
 }
 
 void
@@ -414,13 +620,19 @@ vs_info_finalize(struct limare_state *state, struct vs_info *info)
 	}
 }
 
-void
+int
 plbu_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 {
 	struct plbu_info *info = draw->plbu;
 	struct vs_info *vs = draw->vs;
-	struct lima_cmd *cmds = state->plbu_commands;
-	int i = state->plbu_commands_count;
+	struct lima_cmd *cmds;
+	int i;
+
+	if (plbu_commands_reserve(state, 5))
+		return -1;
+
+	cmds = state->plbu_commands;
+	i = state->plbu_commands_count;
 
 	/*
 	 *
@@ -448,13 +660,21 @@ plbu_commands_draw_add(struct limare_state *state, struct draw_info *draw)
 
 	/* update our size so we can set the gp job properly */
 	state->plbu_commands_count = i;
+
+	return 0;
 }
 
-void
+int
 plbu_commands_finish(struct limare_state *state)
 {
-	struct lima_cmd *cmds = state->plbu_commands;
-	int i = state->plbu_commands_count;
+	struct lima_cmd *cmds;
+	int i;
+
+	if (plbu_commands_reserve(state, 3))
+		return -1;
+
+	cmds = state->plbu_commands;
+	i = state->plbu_commands_count;
 
 	/*
 	 * Some inter-frame communication apparently.
@@ -499,71 +719,70 @@ plbu_commands_finish(struct limare_state *state)
 
 	/* update our size so we can set the gp job properly */
 	state->plbu_commands_count = i;
+
+	return 0;
 }
 
+/*
+ * The shader is uploaded once, at link time, all draws share that copy.
+ */
 int
-plbu_info_attach_shader(struct draw_info *draw, unsigned int *shader, int size)
+plbu_info_attach_shader(struct draw_info *draw, unsigned int *shader,
+		       unsigned int physical, int size)
 {
 	struct plbu_info *info = draw->plbu;
-	int mem_size;
 
 	if (info->shader != NULL) {
 		printf("%s: shader already assigned\n", __func__);
 		return -1;
 	}
 
-	mem_size = ALIGN(size * 4, 0x40);
-	if (mem_size > (draw->mem_size - draw->mem_used)) {
-		printf("%s: no more space\n", __func__);
-		return -2;
-	}
-
-	info->shader = draw->mem_address + draw->mem_used;
-	info->shader_offset = draw->mem_used;
+	info->shader = shader;
+	info->shader_physical = physical;
 	info->shader_size = size;
-	draw->mem_used += mem_size;
-
-	memcpy(info->shader, shader, 4 * size);
 
 	return 0;
 }
 
+/*
+ * Fragment uniforms are half floats, see vs_uniform_pack for the rest.
+ */
+int
+plbu_uniform_pack(void *block, struct symbol *symbol)
+{
+	hfloat *halves = block + symbol->component_size * symbol->offset;
+	float *fulls = symbol->data;
+	int j;
+
+	for (j = 0; j < symbol->component_count; j++)
+		halves[j] = float_to_hfloat(fulls[j]);
+
+	return symbol->component_count * sizeof(hfloat);
+}
+
 int
-plbu_info_attach_uniforms(struct draw_info *draw, struct symbol **uniforms,
-			  int count, int size)
+plbu_info_attach_uniforms(struct limare_state *state, struct draw_info *draw,
+			  struct symbol **uniforms, int count, int size)
 {
 	struct plbu_info *info = draw->plbu;
 	void *address;
-	unsigned int *array;
 	int i;
 
 	if (!count)
 		return 0;
 
-	info->uniform_array_offset = draw->mem_used;
-	info->uniform_array_size = 4;
-	draw->mem_used += 0x40;
-
-	array = draw->mem_address + info->uniform_array_offset;
-
-	info->uniform_offset = draw->mem_used;
 	info->uniform_size = size;
-	draw->mem_used += ALIGN(4 * size, 0x40);
 
-	address = draw->mem_address + info->uniform_offset;
-	array[0] = draw->mem_physical + info->uniform_offset;
-
-	for (i = 0; i < count; i++) {
-		struct symbol *symbol = uniforms[i];
-		hfloat *halves = address +
-			symbol->component_size * symbol->offset;
-		float *fulls = symbol->data;
+	address = uniform_cache_scratch(state->uniform_cache, 4 * size);
+	if (!address)
+		return -1;
 
-		for (i = 0; i < symbol->component_count; i++)
-			halves[i] = float_to_hfloat(fulls[i]);
-	}
+	for (i = 0; i < count; i++)
+		state->stats.bytes_copied +=
+			plbu_uniform_pack(address, uniforms[i]);
 
-	return 0;
+	return uniform_block_get(state, UNIFORM_BLOCK_FRAGMENT, address,
+				 4 * size, &info->uniform_array_physical);
 }
 
 int
@@ -609,8 +828,7 @@ plbu_info_render_state_create(struct draw_info *draw)
 	state->unknown20 = 0xF807;
 	/* enable 4x MSAA */
 	state->unknown20 |= 0x68;
-	state->shader_address =
-		(draw->mem_physical + info->shader_offset) | info->shader_size;
+	state->shader_address = info->shader_physical | info->shader_size;
 
 	state->uniforms_address = 0;
 
@@ -636,8 +854,7 @@ plbu_info_render_state_create(struct draw_info *draw)
 	}
 
 	if (info->uniform_size) {
-		state->uniforms_address =
-			(int) draw->mem_physical + info->uniform_array_offset;
+		state->uniforms_address = info->uniform_array_physical;
 
 		state->uniforms_address |=
 			(ALIGN(info->uniform_size, 4) / 4) - 1;
@@ -650,13 +867,20 @@ plbu_info_render_state_create(struct draw_info *draw)
 }
 
 int
-limare_gp_job_start(struct limare_state *state)
+limare_gp_job_start(struct limare_state *state, int priority, int watchdog,
+		    struct limare_fence **fence)
 {
 	struct lima_gp_job_start *job;
 
 	job = calloc(1, sizeof(struct lima_gp_job_start));
+	if (!job) {
+		printf("%s: Error: failed to allocate job: %s\n",
+		       __func__, strerror(errno));
+		return -ENOMEM;
+	}
 
-	state->gp_job = job;
+	/* the job, and the fence tracking it. */
+	state->stats.allocations += 2;
 
 	job->frame.vs_commands_start = state->vs_commands_physical;
 	job->frame.vs_commands_end =
@@ -667,20 +891,72 @@ limare_gp_job_start(struct limare_state *state)
 	job->frame.tile_heap_start = 0;
 	job->frame.tile_heap_end = 0;
 
-	return limare_gp_job_start_direct(state, job);
+	if (state->decode)
+		decode_gp_job(state, state->decode, &job->frame);
+
+	return limare_gp_job_start_direct(state, job, priority, watchdog, NULL,
+					  fence);
+}
+
+/*
+ * Calculates how much memory a draw will take up, so that we only need to
+ * allocate exactly that. This needs to follow the vs_info and plbu_info
+ * attach functions.
+ */
+int
+draw_mem_size(struct limare_state *state, int vertex_count)
+{
+	int size = 0, i;
+
+	if (state->type == LIMARE_TYPE_M200)
+		size += ALIGN(sizeof(struct gp_common), 0x40);
+	else if (state->type == LIMARE_TYPE_M400)
+		size += 2 * ALIGN(0x10 * sizeof(struct gp_common_entry), 0x40);
+
+	for (i = 0; i < state->vertex_attribute_count; i++) {
+		struct symbol *symbol = state->vertex_attributes[i];
+
+		if (symbol->data_physical)
+			continue;
+
+		size += ALIGN(symbol->component_size *
+			      symbol->component_count * vertex_count, 0x40);
+	}
+
+	for (i = 0; i < state->vertex_varying_count; i++) {
+		struct symbol *symbol = state->vertex_varyings[i];
+
+		size += ALIGN(symbol->component_size *
+			      symbol->component_count * vertex_count, 0x40);
+	}
+
+	size += ALIGN(sizeof(struct render_state), 0x40);
+
+	return size;
 }
 
 struct draw_info *
-draw_create_new(struct limare_state *state, int offset, int size,
+draw_create_new(struct limare_state *state, int size,
 		int draw_mode, int vertex_start, int vertex_count)
 {
-	struct draw_info *draw = calloc(1, sizeof(struct draw_info));
+	struct mem_ring *ring = state->draw_ring;
+	struct draw_info *draw;
+	int offset;
+
+	/* draw memory only lives until the frame is retired. */
+	offset = mem_ring_alloc(ring, size, MEM_ALIGN_DEFAULT);
+	if (offset < 0)
+		return NULL;
 
+	draw = arena_calloc(state->frame_arena, sizeof(struct draw_info));
 	if (!draw)
 		return NULL;
 
-	draw->mem_address = state->mem_address + offset;
-	draw->mem_physical = state->mem_physical + offset;
+	state->stats.allocations += 2;
+
+	draw->mem_address = ring->address + offset;
+	draw->mem_physical = ring->physical + offset;
+
 	draw->mem_used = 0;
 	draw->mem_size = size;
 
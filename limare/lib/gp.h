@@ -50,7 +50,7 @@ struct vs_info {
 	int varying_area_offset;
 	int varying_area_size;
 
-	int uniform_offset;
+	unsigned int uniform_physical;
 	int uniform_size;
 
 	struct symbol *attributes[0x10];
@@ -62,18 +62,21 @@ struct vs_info {
 	int varying_element_size;
 
 	unsigned int *shader;
-	int shader_offset;
+	unsigned int shader_physical;
 	int shader_size;
 };
 
-int vs_info_attach_uniforms(struct draw_info *draw, struct symbol **uniforms,
-			    int count, int size);
+int vs_info_attach_uniforms(struct limare_state *state, struct draw_info *draw,
+			    struct symbol **uniforms, int count, int size);
 
 int vs_info_attach_attribute(struct draw_info *draw, struct symbol *attribute);
 int vs_info_attach_varying(struct draw_info *draw, struct symbol *varying);
-int vs_info_attach_shader(struct draw_info *draw, unsigned int *shader, int size);
+int vs_info_attach_shader(struct draw_info *draw, unsigned int *shader,
+			  unsigned int physical, int size);
 
-void vs_commands_draw_add(struct limare_state *state, struct draw_info *draw);
+int vs_uniform_pack(void *block, struct symbol *symbol);
+
+int vs_commands_draw_add(struct limare_state *state, struct draw_info *draw);
 void vs_info_finalize(struct limare_state *state, struct vs_info *info);
 
 struct plbu_info {
@@ -82,25 +85,34 @@ struct plbu_info {
 	int render_state_size;
 
 	unsigned int *shader;
-	int shader_offset;
+	unsigned int shader_physical;
 	int shader_size;
 
-	int uniform_array_offset;
-	int uniform_array_size;
-
-	int uniform_offset;
+	/* points to the array, which points to the uniforms themselves. */
+	unsigned int uniform_array_physical;
 	int uniform_size;
 };
 
-int vs_command_queue_create(struct limare_state *state, int offset, int size);
-int plbu_command_queue_create(struct limare_state *state, int offset, int size);
+int vs_command_queue_create(struct limare_state *state, int size);
+int plbu_command_queue_create(struct limare_state *state, int size);
+
+void vs_commands_start(struct limare_state *state);
+void plbu_commands_start(struct limare_state *state);
+
+int plbu_commands_draw_add(struct limare_state *state, struct draw_info *draw);
+int plbu_commands_finish(struct limare_state *state);
 
-void plbu_commands_draw_add(struct limare_state *state, struct draw_info *draw);
-void plbu_commands_finish(struct limare_state *state);
+int vs_commands_append(struct limare_state *state, struct lima_cmd *cmds,
+		       int count);
+int plbu_commands_append(struct limare_state *state, struct lima_cmd *cmds,
+			 int count);
 
-int plbu_info_attach_shader(struct draw_info *draw, unsigned int *shader, int size);
-int plbu_info_attach_uniforms(struct draw_info *draw, struct symbol **uniforms,
-			    int count, int size);
+int plbu_info_attach_shader(struct draw_info *draw, unsigned int *shader,
+			    unsigned int physical, int size);
+int plbu_uniform_pack(void *block, struct symbol *symbol);
+int plbu_info_attach_uniforms(struct limare_state *state,
+			      struct draw_info *draw,
+			      struct symbol **uniforms, int count, int size);
 
 int plbu_info_render_state_create(struct draw_info *draw);
 
@@ -119,10 +131,12 @@ struct draw_info {
 	struct plbu_info plbu[1];
 };
 
-struct draw_info *draw_create_new(struct limare_state *state, int offset,
-				  int size, int draw_mode, int vertex_start,
+int draw_mem_size(struct limare_state *state, int vertex_count);
+struct draw_info *draw_create_new(struct limare_state *state, int size,
+				  int draw_mode, int vertex_start,
 				  int vertex_count);
 
-int limare_gp_job_start(struct limare_state *state);
+int limare_gp_job_start(struct limare_state *state, int priority,
+			int watchdog, struct limare_fence **fence);
 
 #endif /* LIMARE_GP_H */
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "hfloat.h"
 
 /*
@@ -68,3 +70,36 @@ float_to_hfloat(float fp)
 
 	return (hfloat) ((sign << 15) | (exp << 10) | (mantissa));
 }
+
+/*
+ * And the way back, for reading what the gpu wrote out.
+ */
+float
+hfloat_to_float(hfloat hf)
+{
+	unsigned int sign = (hf >> 15) & 0x01;
+	unsigned int exp = (hf >> 10) & 0x1F;
+	unsigned int mantissa = hf & 0x03FF;
+	unsigned int x;
+	float f;
+
+	if (exp == 0x1F) { /* infinity or nan */
+		exp = 0xFF;
+		mantissa <<= 13;
+	} else if (exp) {
+		exp += 0x70;
+		mantissa <<= 13;
+	} else if (mantissa) { /* denormal, becomes a normal float */
+		exp = 0x71;
+		while (!(mantissa & 0x0400)) {
+			mantissa <<= 1;
+			exp--;
+		}
+		mantissa = (mantissa & 0x03FF) << 13;
+	}
+
+	x = (sign << 31) | (exp << 23) | mantissa;
+	memcpy(&f, &x, sizeof(f));
+
+	return f;
+}
@@ -7,5 +7,6 @@
 typedef unsigned short hfloat;
 
 hfloat float_to_hfloat(float fp);
+float hfloat_to_float(hfloat hf);
 
 #endif /* HFLOAT_H */
@@ -22,7 +22,8 @@
  */
 
 /*
- * Simplistic job handling.
+ * Job handling: jobs are queued per core, and are tracked until the
+ * notification thread has seen them finish.
  */
 
 #include <stdlib.h>
@@ -32,6 +33,9 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define u32 uint32_t
 #include "linux/mali_ioctl.h"
@@ -39,126 +43,1128 @@
 #include "linux/ioctl.h"
 #include "limare.h"
 #include "jobs.h"
+#include "backend.h"
 
-static _mali_uk_wait_for_notification_s wait;
-static pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* how long the notification thread blocks before checking for stop. */
+#define LIMARE_JOBS_WAIT_TIMEOUT 100
 
+struct limare_jobs {
+	struct limare_state *state;
+	const struct limare_backend *backend;
+
+	pthread_t thread;
+	int stop;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/*
+	 * The kernel only takes as many jobs as there are cores of a type,
+	 * so jobs are queued here, in order, until a core is free.
+	 */
+	struct limare_fence *queue[LIMARE_JOB_CORES];
+	struct limare_fence *queue_tail[LIMARE_JOB_CORES];
+	struct limare_fence *running[LIMARE_JOB_CORES][LIMARE_JOB_SLOTS_MAX];
+	int running_count[LIMARE_JOB_CORES];
+	int slots[LIMARE_JOB_CORES];
+	int pending_count; /* queued and running */
+
+	/* completion queue, in order of completion. */
+	struct limare_fence *completed;
+	struct limare_fence *completed_tail;
+
+	/*
+	 * When a client asked for an event fd, a byte is written to this
+	 * pipe for every finished job, and callbacks are only run from
+	 * limare_jobs_dispatch().
+	 */
+	int event_pipe[2];
+	int event_mode;
+
+	/* ms, handed to the kernel with each job. */
+	int watchdog;
+
+	/*
+	 * The kernel interface broke down, or a job never came back, all
+	 * jobs fail from here on.
+	 */
+	int dead;
+};
+
+/*
+ * Monotonic time in ms, for the watchdog.
+ */
+static long long
+limare_jobs_msecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000LL) + (now.tv_nsec / 1000000);
+}
+
+/*
+ * Turn a job status into an error code, 0 meaning success.
+ */
+int
+limare_fence_error(unsigned int status)
+{
+	switch (status) {
+	case _MALI_UK_JOB_STATUS_END_SUCCESS:
+		return 0;
+	case _MALI_UK_JOB_STATUS_END_OOM:
+		return -ENOMEM;
+	case _MALI_UK_JOB_STATUS_END_ABORT:
+		return -ECANCELED;
+	case _MALI_UK_JOB_STATUS_END_TIMEOUT_SW:
+	case _MALI_UK_JOB_STATUS_END_HANG:
+		return -ETIME;
+	case _MALI_UK_JOB_STATUS_END_SEG_FAULT:
+		return -EFAULT;
+	case _MALI_UK_JOB_STATUS_END_ILLEGAL_JOB:
+		return -EINVAL;
+	case _MALI_UK_JOB_STATUS_END_SHUTDOWN:
+		return -ESHUTDOWN;
+	default:
+		return -EIO;
+	}
+}
+
+/*
+ * Drop a reference, called with the mutex held.
+ */
+static void
+limare_fence_unref(struct limare_fence *fence)
+{
+	fence->refcount--;
+	if (!fence->refcount) {
+		if (fence->after)
+			limare_fence_unref(fence->after);
+		free(fence->job);
+		free(fence);
+	}
+}
+
+/*
+ * Called with the mutex held.
+ */
+static void
+limare_fence_signal(struct limare_jobs *jobs, struct limare_fence *fence,
+		    unsigned int status)
+{
+	jobs->pending_count--;
+
+	fence->status = status;
+	fence->signaled = 1;
+	fence->next = NULL;
+
+	if (fence->merge) {
+		struct limare_fence *merge = fence->merge;
+
+		fence->merge = NULL;
+
+		if ((status != _MALI_UK_JOB_STATUS_END_SUCCESS) &&
+		    (merge->status == _MALI_UK_JOB_STATUS_END_SUCCESS))
+			merge->status = status;
+
+		merge->merge_pending--;
+		if (!merge->merge_pending)
+			limare_fence_signal(jobs, merge, merge->status);
+
+		limare_fence_unref(merge);
+	}
+
+	if (jobs->completed_tail)
+		jobs->completed_tail->next = fence;
+	else
+		jobs->completed = fence;
+	jobs->completed_tail = fence;
+
+	pthread_cond_broadcast(&jobs->cond);
+
+	/* a full pipe is readable already, so it is fine to not get through. */
+	if (jobs->event_mode) {
+		char byte = 0;
+
+		if (write(jobs->event_pipe[1], &byte, 1) == -1 &&
+		    errno != EAGAIN)
+			printf("%s: Error: failed to write event: %s\n",
+			       __func__, strerror(errno));
+	}
+}
+
+/*
+ * Insert a job behind all queued jobs of the same or a more urgent
+ * priority. Called with the mutex held.
+ */
+static void
+limare_jobs_queue_insert(struct limare_jobs *jobs, struct limare_fence *fence)
+{
+	int core = fence->core;
+	struct limare_fence **link = &jobs->queue[core];
+
+	while (*link && ((*link)->priority <= fence->priority))
+		link = &(*link)->next;
+
+	fence->next = *link;
+	*link = fence;
+	if (!fence->next)
+		jobs->queue_tail[core] = fence;
+}
+
+/*
+ * Take a job out of the queue of its core. Called with the mutex held.
+ */
+static void
+limare_jobs_queue_remove(struct limare_jobs *jobs, struct limare_fence *fence)
+{
+	int core = fence->core;
+	struct limare_fence **link = &jobs->queue[core];
+	struct limare_fence *previous = NULL;
+
+	while (*link != fence) {
+		previous = *link;
+		link = &(*link)->next;
+	}
+
+	*link = fence->next;
+	if (jobs->queue_tail[core] == fence)
+		jobs->queue_tail[core] = previous;
+	fence->next = NULL;
+}
+
+/*
+ * Take a job off its core. Called with the mutex held.
+ */
+static void
+limare_jobs_running_remove(struct limare_jobs *jobs, int core, int index)
+{
+	jobs->running_count[core]--;
+	jobs->running[core][index] =
+		jobs->running[core][jobs->running_count[core]];
+	jobs->running[core][jobs->running_count[core]] = NULL;
+}
+
+/*
+ * The kernel handed back a job which it had not started yet, it has to be
+ * queued again. Called with the mutex held.
+ */
+static void
+limare_jobs_returned(struct limare_jobs *jobs, int core,
+		     unsigned int user_job_ptr)
+{
+	struct limare_fence *fence;
+	int i;
+
+	for (i = 0; i < jobs->running_count[core]; i++)
+		if ((unsigned int) jobs->running[core][i] == user_job_ptr)
+			break;
+
+	if (i == jobs->running_count[core]) {
+		printf("%s: Error: unknown job 0x%08X returned\n",
+		       __func__, user_job_ptr);
+		return;
+	}
+
+	fence = jobs->running[core][i];
+	limare_jobs_running_remove(jobs, core, i);
+
+	limare_jobs_queue_insert(jobs, fence);
+}
+
+/*
+ * Hand the next jobs to the kernel, for each core that is free. Called with
+ * the mutex held.
+ */
+static void
+limare_jobs_kick(struct limare_jobs *jobs)
+{
+	struct limare_fence *fence;
+	unsigned int status;
+	int core, ret;
+
+	for (core = 0; core < LIMARE_JOB_CORES; core++) {
+		/* a hung job might hold the core forever. */
+		if (jobs->dead) {
+			while (jobs->queue[core]) {
+				fence = jobs->queue[core];
+				limare_jobs_queue_remove(jobs, fence);
+				limare_fence_signal(jobs, fence,
+					_MALI_UK_JOB_STATUS_END_SYSTEM_UNUSABLE);
+			}
+			continue;
+		}
+
+		while (jobs->running_count[core] < jobs->slots[core]) {
+			/* the most urgent job that is ready to go. */
+			for (fence = jobs->queue[core]; fence;
+			     fence = fence->next)
+				if (!fence->after || fence->after->signaled)
+					break;
+
+			if (!fence)
+				break;
+
+			limare_jobs_queue_remove(jobs, fence);
+
+			if (fence->after) {
+				status = fence->after->status;
+
+				limare_fence_unref(fence->after);
+				fence->after = NULL;
+
+				/* no point in running this one. */
+				if (status != _MALI_UK_JOB_STATUS_END_SUCCESS) {
+					limare_fence_signal(jobs, fence, status);
+					continue;
+				}
+			}
+
+			ret = jobs->backend->job_start(jobs->state,
+						       fence->request,
+						       fence->job);
+			if (ret) {
+				printf("%s: Error: failed to start job: %s\n",
+				       __func__, strerror(ret));
+				limare_fence_signal(jobs, fence,
+					_MALI_UK_JOB_STATUS_END_UNKNOWN_ERR);
+				continue;
+			}
+
+			/*
+			 * All cores are busy after all, try again once the
+			 * next job has finished.
+			 */
+			if (*fence->start_status == JOB_NOT_STARTED_DO_REQUEUE) {
+				fence->next = jobs->queue[core];
+				jobs->queue[core] = fence;
+				if (!fence->next)
+					jobs->queue_tail[core] = fence;
+				break;
+			}
+
+			fence->started = limare_jobs_msecs();
+
+			jobs->running[core][jobs->running_count[core]] = fence;
+			jobs->running_count[core]++;
+
+			/* our job bumped a less urgent one, which was pending. */
+			if (*fence->start_status == JOB_RETURNED)
+				limare_jobs_returned(jobs, core,
+						     *fence->returned_job);
+		}
+	}
+}
+
+/*
+ * Run the callbacks of signaled fences. Called with the mutex held, which
+ * gets dropped while a callback runs.
+ */
+static void
+limare_jobs_callbacks(struct limare_jobs *jobs)
+{
+	struct limare_fence *fence;
+
+ restart:
+	for (fence = jobs->completed; fence; fence = fence->next) {
+		if (!fence->callback || fence->callback_done)
+			continue;
+
+		fence->callback_done = 1;
+		fence->refcount++;
+
+		pthread_mutex_unlock(&jobs->mutex);
+		fence->callback(fence, fence->status, fence->callback_data);
+		pthread_mutex_lock(&jobs->mutex);
+
+		limare_fence_unref(fence);
+
+		/* the list might have been reaped in the meantime. */
+		goto restart;
+	}
+}
+
+/*
+ * Called with the mutex held.
+ */
+static void
+limare_jobs_complete(struct limare_jobs *jobs, int core,
+		     unsigned int user_job_ptr, unsigned int status,
+		     unsigned int irq_status, unsigned int stop_address0,
+		     unsigned int stop_address1)
+{
+	struct limare_fence *fence;
+	int i;
+
+	for (i = 0; i < jobs->running_count[core]; i++)
+		if ((unsigned int) jobs->running[core][i] == user_job_ptr)
+			break;
+
+	if (i == jobs->running_count[core]) {
+		printf("%s: Error: unknown job 0x%08X finished\n",
+		       __func__, user_job_ptr);
+		return;
+	}
+
+	fence = jobs->running[core][i];
+	limare_jobs_running_remove(jobs, core, i);
+
+	fence->irq_status = irq_status;
+	fence->stop_address[0] = stop_address0;
+	fence->stop_address[1] = stop_address1;
+
+	if (status != _MALI_UK_JOB_STATUS_END_SUCCESS) {
+		if (core == LIMARE_JOB_GP)
+			printf("%s: Error: gp job failed: status 0x%08X, irq "
+			       "0x%08X, vs stopped at 0x%08X, plbu at 0x%08X\n",
+			       __func__, status, irq_status, stop_address0,
+			       stop_address1);
+		else
+			printf("%s: Error: pp job failed: status 0x%08X, irq "
+			       "0x%08X, last tile list at 0x%08X\n",
+			       __func__, status, irq_status, stop_address0);
+	}
+
+	limare_fence_signal(jobs, fence, status);
+}
+
+/*
+ * Fail all jobs which have not finished yet. Called with the mutex held.
+ */
+static void
+limare_jobs_cancel(struct limare_jobs *jobs, unsigned int status)
+{
+	struct limare_fence *fence;
+	int core, i;
+
+	for (core = 0; core < LIMARE_JOB_CORES; core++) {
+		for (i = 0; i < jobs->running_count[core]; i++) {
+			limare_fence_signal(jobs, jobs->running[core][i],
+					    status);
+			jobs->running[core][i] = NULL;
+		}
+		jobs->running_count[core] = 0;
+
+		while (jobs->queue[core]) {
+			fence = jobs->queue[core];
+			jobs->queue[core] = fence->next;
+			limare_fence_signal(jobs, fence, status);
+		}
+		jobs->queue_tail[core] = NULL;
+	}
+}
+
+/*
+ * Abort jobs which have overrun their watchdog, and which the kernel did
+ * not deal with. If even the abort goes unanswered, the gpu might still be
+ * using the memory of the job, and its fence address might still come
+ * back from the kernel. So the job stays around until it does, and we
+ * give up on the gpu instead. Called with the mutex held.
+ */
+static void
+limare_jobs_watchdog(struct limare_jobs *jobs)
+{
+	long long now = limare_jobs_msecs();
+	struct limare_fence *fence;
+	int core, i, ret;
+
+	for (core = 0; core < LIMARE_JOB_CORES; core++) {
+		for (i = 0; i < jobs->running_count[core]; i++) {
+			fence = jobs->running[core][i];
+
+			if (!fence->watchdog)
+				continue;
+
+			if ((now - fence->started) <
+			    (fence->watchdog + LIMARE_JOB_ABORT_GRACE))
+				continue;
+
+			if (!fence->abort_sent) {
+				printf("%s: Error: %s job 0x%08X hangs, "
+				       "aborting.\n", __func__,
+				       core == LIMARE_JOB_GP ? "gp" : "pp",
+				       (unsigned int) fence);
+
+				ret = jobs->backend->job_abort(jobs->state,
+						core, (unsigned int) fence);
+				if (ret)
+					printf("%s: Error: abort failed: %s\n",
+					       __func__, strerror(ret));
+
+				fence->abort_sent = 1;
+				continue;
+			}
+
+			if ((now - fence->started) <
+			    (fence->watchdog + 2 * LIMARE_JOB_ABORT_GRACE))
+				continue;
+
+			if (jobs->dead)
+				continue;
+
+			printf("%s: Error: job 0x%08X was not aborted, "
+			       "giving up on the gpu.\n", __func__,
+			       (unsigned int) fence);
+
+			/* wakes up the waiters, the kick fails the queue. */
+			jobs->dead = 1;
+			pthread_cond_broadcast(&jobs->cond);
+		}
+	}
+}
+
+/*
+ * One thread per state, which collects all notifications from the kernel,
+ * and which starts queued jobs once their core is free.
+ */
 static void *
-wait_for_notification(void *arg)
+limare_jobs_thread(void *arg)
 {
-	struct limare_state *state = arg;
+	struct limare_jobs *jobs = arg;
+	_mali_uk_wait_for_notification_s wait;
 	int ret;
 
-	pthread_mutex_lock(&wait_mutex);
+	while (1) {
+		pthread_mutex_lock(&jobs->mutex);
+		if (jobs->stop) {
+			pthread_mutex_unlock(&jobs->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&jobs->mutex);
+
+		memset(&wait, 0, sizeof(wait));
+		wait.code.timeout = LIMARE_JOBS_WAIT_TIMEOUT;
+
+		ret = jobs->backend->notification_wait(jobs->state, &wait);
+		if (ret) {
+			if (ret == EINTR)
+				continue;
 
-	do {
-		wait.code.timeout = 25;
-		ret = ioctl(state->fd, MALI_IOC_WAIT_FOR_NOTIFICATION, &wait);
-		if (ret == -1) {
 			printf("%s: Error: wait failed: %s\n",
-			       __func__, strerror(errno));
-			exit(-1);
+			       __func__, strerror(ret));
+
+			/* without notifications, no job will ever finish. */
+			pthread_mutex_lock(&jobs->mutex);
+			jobs->dead = 1;
+			limare_jobs_cancel(jobs,
+				_MALI_UK_JOB_STATUS_END_SYSTEM_UNUSABLE);
+			if (!jobs->event_mode)
+				limare_jobs_callbacks(jobs);
+			pthread_mutex_unlock(&jobs->mutex);
+			break;
 		}
 
-		sched_yield();
-	} while (wait.code.type == _MALI_NOTIFICATION_CORE_TIMEOUT);
+		pthread_mutex_lock(&jobs->mutex);
+
+		switch (wait.code.type) {
+		case _MALI_NOTIFICATION_GP_FINISHED:
+			limare_jobs_complete(jobs, LIMARE_JOB_GP,
+				wait.data.gp_job_finished.user_job_ptr,
+				wait.data.gp_job_finished.status,
+				wait.data.gp_job_finished.irq_status,
+				wait.data.gp_job_finished.vscl_stop_addr,
+				wait.data.gp_job_finished.plbcl_stop_addr);
+			break;
+		case _MALI_NOTIFICATION_PP_FINISHED:
+			limare_jobs_complete(jobs, LIMARE_JOB_PP,
+				wait.data.pp_job_finished.user_job_ptr,
+				wait.data.pp_job_finished.status,
+				wait.data.pp_job_finished.irq_status,
+				wait.data.pp_job_finished.last_tile_list_addr,
+				0);
+			break;
+		case _MALI_NOTIFICATION_CORE_SHUTDOWN_IN_PROGRESS:
+			jobs->stop = 1;
+			jobs->dead = 1;
+			limare_jobs_cancel(jobs,
+					   _MALI_UK_JOB_STATUS_END_SHUTDOWN);
+			break;
+		default: /* timeouts */
+			break;
+		}
 
-	printf("%s: done!\n", __func__);
+		limare_jobs_watchdog(jobs);
+		limare_jobs_kick(jobs);
+		if (!jobs->event_mode)
+			limare_jobs_callbacks(jobs);
 
-	pthread_mutex_unlock(&wait_mutex);
+		pthread_mutex_unlock(&jobs->mutex);
+	}
 
 	return NULL;
 }
 
+struct limare_jobs *
+limare_jobs_create(struct limare_state *state)
+{
+	struct limare_jobs *jobs;
+	int ret;
+
+	jobs = calloc(1, sizeof(struct limare_jobs));
+	if (!jobs) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	jobs->state = state;
+	jobs->backend = state->backend;
+	jobs->watchdog = LIMARE_JOB_WATCHDOG_DEFAULT;
+
+	jobs->slots[LIMARE_JOB_GP] = 1;
+	jobs->slots[LIMARE_JOB_PP] = state->pp_core_count;
+	if (jobs->slots[LIMARE_JOB_PP] > LIMARE_JOB_SLOTS_MAX)
+		jobs->slots[LIMARE_JOB_PP] = LIMARE_JOB_SLOTS_MAX;
+	if (jobs->slots[LIMARE_JOB_PP] < 1)
+		jobs->slots[LIMARE_JOB_PP] = 1;
+
+	jobs->event_pipe[0] = -1;
+	jobs->event_pipe[1] = -1;
+
+	pthread_mutex_init(&jobs->mutex, NULL);
+	pthread_cond_init(&jobs->cond, NULL);
+
+	ret = pthread_create(&jobs->thread, NULL, limare_jobs_thread, jobs);
+	if (ret) {
+		printf("%s: Error: failed to create thread: %s\n",
+		       __func__, strerror(ret));
+		pthread_cond_destroy(&jobs->cond);
+		pthread_mutex_destroy(&jobs->mutex);
+		free(jobs);
+		return NULL;
+	}
+
+	return jobs;
+}
+
+/*
+ * Drop all finished jobs, apart from those of which the callback still has
+ * to be run. Called with the mutex held.
+ */
+static void
+limare_jobs_reap(struct limare_jobs *jobs)
+{
+	struct limare_fence *fence = jobs->completed;
+
+	jobs->completed = NULL;
+	jobs->completed_tail = NULL;
+
+	while (fence) {
+		struct limare_fence *next = fence->next;
+
+		fence->next = NULL;
+
+		if (fence->callback && !fence->callback_done) {
+			if (jobs->completed_tail)
+				jobs->completed_tail->next = fence;
+			else
+				jobs->completed = fence;
+			jobs->completed_tail = fence;
+		} else {
+			free(fence->job);
+			fence->job = NULL;
+
+			limare_fence_unref(fence);
+		}
+
+		fence = next;
+	}
+}
+
 void
-wait_for_notification_start(struct limare_state *state)
+limare_jobs_destroy(struct limare_jobs *jobs)
 {
-	pthread_t thread;
+	pthread_mutex_lock(&jobs->mutex);
+	jobs->stop = 1;
+	pthread_mutex_unlock(&jobs->mutex);
+
+	pthread_join(jobs->thread, NULL);
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	/* whoever still holds these will find them signaled. */
+	limare_jobs_cancel(jobs, _MALI_UK_JOB_STATUS_END_SHUTDOWN);
+
+	/* nobody is going to dispatch these anymore. */
+	limare_jobs_callbacks(jobs);
+	limare_jobs_reap(jobs);
+
+	pthread_mutex_unlock(&jobs->mutex);
+
+	if (jobs->event_mode) {
+		close(jobs->event_pipe[0]);
+		close(jobs->event_pipe[1]);
+	}
+
+	pthread_cond_destroy(&jobs->cond);
+	pthread_mutex_destroy(&jobs->mutex);
+	free(jobs);
+}
+
+/*
+ * Returns a file descriptor which becomes readable when a job has finished,
+ * for use with poll or epoll. From then on, fence callbacks are no longer
+ * run from the notification thread, but from limare_jobs_dispatch(), in
+ * the thread of the client.
+ */
+int
+limare_jobs_event_fd(struct limare_state *state)
+{
+	struct limare_jobs *jobs = state->jobs;
+	int ret = 0, i;
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	if (jobs->event_mode)
+		goto done;
+
+	if (pipe(jobs->event_pipe) == -1) {
+		printf("%s: Error: failed to create pipe: %s\n",
+		       __func__, strerror(errno));
+		ret = -1;
+		goto done;
+	}
+
+	for (i = 0; i < 2; i++) {
+		fcntl(jobs->event_pipe[i], F_SETFL,
+		      fcntl(jobs->event_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(jobs->event_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	jobs->event_mode = 1;
+
+	/* jobs might have finished before we got here. */
+	if (jobs->completed) {
+		char byte = 0;
+
+		if (write(jobs->event_pipe[1], &byte, 1) == -1 &&
+		    errno != EAGAIN)
+			printf("%s: Error: failed to write event: %s\n",
+			       __func__, strerror(errno));
+	}
+
+ done:
+	pthread_mutex_unlock(&jobs->mutex);
+
+	if (ret)
+		return ret;
+	return jobs->event_pipe[0];
+}
+
+/*
+ * Handle all jobs that have finished so far, without blocking: the event
+ * fd gets drained, and the callbacks of finished fences are run.
+ */
+void
+limare_jobs_dispatch(struct limare_state *state)
+{
+	struct limare_jobs *jobs = state->jobs;
+	char buffer[64];
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	/* drain first, so that whatever finishes from here on wakes us up. */
+	if (jobs->event_mode)
+		while (read(jobs->event_pipe[0], buffer, sizeof(buffer)) > 0)
+			;
+
+	limare_jobs_callbacks(jobs);
+	limare_jobs_reap(jobs);
+
+	pthread_mutex_unlock(&jobs->mutex);
+}
+
+/*
+ * A fence tracks a job from submission until it has finished, and its
+ * address is the user_job_ptr of the job.
+ */
+static struct limare_fence *
+limare_fence_create(int core, unsigned long request, void *job,
+		    struct limare_fence *after, int held)
+{
+	struct limare_fence *fence;
+
+	fence = calloc(1, sizeof(struct limare_fence));
+	if (!fence) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	fence->core = core;
+	fence->request = request;
+	fence->job = job;
+	fence->after = after;
+	fence->refcount = held ? 2 : 1;
+
+	return fence;
+}
+
+/*
+ * Returns a fence which signals once all the given fences have signaled,
+ * with the first failing status, if any. For jobs which together make up
+ * a single piece of work, like a frame split over several pp cores.
+ */
+struct limare_fence *
+limare_fence_merge(struct limare_state *state, struct limare_fence **fences,
+		   int count)
+{
+	struct limare_jobs *jobs = state->jobs;
+	struct limare_fence *merge;
+	int i;
+
+	merge = limare_fence_create(-1, 0, NULL, NULL, 1);
+	if (!merge)
+		return NULL;
+
+	merge->status = _MALI_UK_JOB_STATUS_END_SUCCESS;
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	/* counts as pending, so that limare_jobs_wait() covers it. */
+	jobs->pending_count++;
+
+	for (i = 0; i < count; i++) {
+		if (fences[i]->signaled) {
+			if ((fences[i]->status !=
+			     _MALI_UK_JOB_STATUS_END_SUCCESS) &&
+			    (merge->status == _MALI_UK_JOB_STATUS_END_SUCCESS))
+				merge->status = fences[i]->status;
+			continue;
+		}
+
+		/* each fence that is merged in holds a reference. */
+		fences[i]->merge = merge;
+		merge->merge_pending++;
+		merge->refcount++;
+	}
+
+	if (!merge->merge_pending)
+		limare_fence_signal(jobs, merge, merge->status);
+
+	pthread_mutex_unlock(&jobs->mutex);
+
+	return merge;
+}
+
+/*
+ * Queue the job, it gets started as soon as its core is free, and the job
+ * it depends on, if any, has finished.
+ */
+static void
+limare_jobs_queue(struct limare_jobs *jobs, struct limare_fence *fence)
+{
+	pthread_mutex_lock(&jobs->mutex);
+
+	/* keep the completion queue short. */
+	limare_jobs_reap(jobs);
+
+	if (fence->after)
+		fence->after->refcount++;
+
+	limare_jobs_queue_insert(jobs, fence);
+	jobs->pending_count++;
+
+	limare_jobs_kick(jobs);
+	if (!jobs->event_mode)
+		limare_jobs_callbacks(jobs);
+
+	pthread_mutex_unlock(&jobs->mutex);
+}
+
+/*
+ * Wait until all queued jobs have finished.
+ */
+void
+limare_jobs_wait(struct limare_state *state)
+{
+	struct limare_jobs *jobs = state->jobs;
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	while (jobs->pending_count && !jobs->stop && !jobs->dead)
+		pthread_cond_wait(&jobs->cond, &jobs->mutex);
+
+	limare_jobs_reap(jobs);
+
+	pthread_mutex_unlock(&jobs->mutex);
+}
+
+/*
+ * Returns 1 when the job behind the fence has finished, 0 otherwise.
+ */
+int
+limare_fence_query(struct limare_state *state, struct limare_fence *fence)
+{
+	struct limare_jobs *jobs = state->jobs;
+	int signaled;
+
+	pthread_mutex_lock(&jobs->mutex);
+	signaled = fence->signaled;
+	pthread_mutex_unlock(&jobs->mutex);
+
+	return signaled;
+}
+
+/*
+ * Returns 0 when the job behind the fence has finished successfully,
+ * -EBUSY when it has not finished yet, and a negative error code when it
+ * failed.
+ */
+int
+limare_fence_status(struct limare_state *state, struct limare_fence *fence)
+{
+	struct limare_jobs *jobs = state->jobs;
+	int ret;
+
+	pthread_mutex_lock(&jobs->mutex);
+	if (fence->signaled)
+		ret = limare_fence_error(fence->status);
+	else
+		ret = -EBUSY;
+	pthread_mutex_unlock(&jobs->mutex);
+
+	return ret;
+}
+
+/*
+ * Wait for the job behind the fence to finish, for at most timeout
+ * milliseconds, or forever when timeout is negative. Returns 0 when the
+ * job has finished successfully, -ETIMEDOUT when it has not finished, and
+ * a negative error code when it failed, see limare_fence_error().
+ */
+int
+limare_fence_wait(struct limare_state *state, struct limare_fence *fence,
+		  int timeout)
+{
+	struct limare_jobs *jobs = state->jobs;
+	struct timespec end;
+	int ret = 0;
+
+	if (timeout > 0) {
+		clock_gettime(CLOCK_REALTIME, &end);
+		end.tv_sec += timeout / 1000;
+		end.tv_nsec += (timeout % 1000) * 1000000;
+		if (end.tv_nsec >= 1000000000) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	while (!fence->signaled && !jobs->stop && !jobs->dead) {
+		if (!timeout) {
+			ret = ETIMEDOUT;
+			break;
+		} else if (timeout < 0)
+			pthread_cond_wait(&jobs->cond, &jobs->mutex);
+		else {
+			ret = pthread_cond_timedwait(&jobs->cond,
+						     &jobs->mutex, &end);
+			if (ret == ETIMEDOUT)
+				break;
+		}
+	}
+
+	if (fence->signaled)
+		ret = -limare_fence_error(fence->status);
+	else if (!ret)
+		ret = EIO; /* no notifications anymore, or the gpu hangs. */
 
-	pthread_create(&thread, NULL, wait_for_notification, state);
+	pthread_mutex_unlock(&jobs->mutex);
+
+	return -ret;
 }
 
+/*
+ * Have callback called once the job behind the fence has finished. This
+ * happens either right away, or from the notification thread, so the
+ * callback should not call back into limare. When an event fd is in use,
+ * it happens from limare_dispatch() instead.
+ */
 void
-limare_jobs_wait(void)
+limare_fence_callback(struct limare_state *state, struct limare_fence *fence,
+		      void (*callback)(struct limare_fence *fence,
+				       unsigned int status, void *data),
+		      void *data)
 {
-	pthread_mutex_lock(&wait_mutex);
-	pthread_mutex_unlock(&wait_mutex);
+	struct limare_jobs *jobs = state->jobs;
+	unsigned int status;
+	int signaled;
+
+	pthread_mutex_lock(&jobs->mutex);
+
+	signaled = fence->signaled;
+	status = fence->status;
+
+	fence->callback = callback;
+	fence->callback_data = data;
+	fence->callback_done = signaled;
+
+	pthread_mutex_unlock(&jobs->mutex);
+
+	if (signaled)
+		callback(fence, status, data);
+}
+
+/*
+ * How long jobs submitted from now on may run, in ms. 0 disables the
+ * watchdog.
+ */
+void
+limare_watchdog_set(struct limare_state *state, int msecs)
+{
+	struct limare_jobs *jobs = state->jobs;
+
+	pthread_mutex_lock(&jobs->mutex);
+	jobs->watchdog = msecs;
+	pthread_mutex_unlock(&jobs->mutex);
+}
+
+static int
+limare_jobs_watchdog_get(struct limare_jobs *jobs)
+{
+	int watchdog;
+
+	pthread_mutex_lock(&jobs->mutex);
+	watchdog = jobs->watchdog;
+	pthread_mutex_unlock(&jobs->mutex);
+
+	return watchdog;
+}
+
+void
+limare_fence_ref(struct limare_state *state, struct limare_fence *fence)
+{
+	struct limare_jobs *jobs = state->jobs;
+
+	pthread_mutex_lock(&jobs->mutex);
+	fence->refcount++;
+	pthread_mutex_unlock(&jobs->mutex);
+}
+
+void
+limare_fence_release(struct limare_state *state, struct limare_fence *fence)
+{
+	struct limare_jobs *jobs = state->jobs;
+
+	pthread_mutex_lock(&jobs->mutex);
+	limare_fence_unref(fence);
+	pthread_mutex_unlock(&jobs->mutex);
 }
 
 int
 limare_gp_job_start_direct(struct limare_state *state,
-			    struct lima_gp_job_start *job)
+			   struct lima_gp_job_start *job,
+			   int priority, int watchdog,
+			   struct limare_fence *after,
+			   struct limare_fence **fence)
 {
-	int ret;
+	struct limare_fence *tracker;
 
-	/* now run the job */
-	limare_jobs_wait();
+	tracker = limare_fence_create(LIMARE_JOB_GP, LIMA_GP_START_JOB, job,
+				      after, fence != NULL);
+	if (!tracker) {
+		free(job);
+		return -ENOMEM;
+	}
 
-	wait_for_notification_start(state);
+	tracker->start_status = &job->status;
+	tracker->returned_job = &job->returned_user_job_ptr;
+	tracker->priority = priority;
+	if (watchdog < 0)
+		tracker->watchdog = limare_jobs_watchdog_get(state->jobs);
+	else
+		tracker->watchdog = watchdog;
 
 	job->fd = state->fd;
-	job->user_job_ptr = (unsigned int) job;
-	job->priority = 1;
-	job->watchdog_msecs = 0;
-	job->abort_id = 0;
-	ret = ioctl(state->fd, LIMA_GP_START_JOB, job);
-	if (ret == -1) {
-		printf("%s: Error: failed to start job: %s\n",
-		       __func__, strerror(errno));
-		return errno;
-	}
+	job->user_job_ptr = (unsigned int) tracker;
+	job->priority = priority;
+	job->watchdog_msecs = tracker->watchdog;
+	job->abort_id = (unsigned int) tracker;
+
+	limare_jobs_queue(state->jobs, tracker);
+
+	if (fence)
+		*fence = tracker;
 
 	return 0;
 }
 
 int
 limare_m200_pp_job_start_direct(struct limare_state *state,
-				struct lima_m200_pp_job_start *job)
+				struct lima_m200_pp_job_start *job,
+				int priority, int watchdog,
+				struct limare_fence *after,
+				struct limare_fence **fence)
 {
-	int ret;
+	struct limare_fence *tracker;
 
-	limare_jobs_wait();
+	tracker = limare_fence_create(LIMARE_JOB_PP, LIMA_M200_PP_START_JOB,
+				      job, after, fence != NULL);
+	if (!tracker) {
+		free(job);
+		return -ENOMEM;
+	}
 
-	wait_for_notification_start(state);
+	tracker->start_status = &job->status;
+	tracker->returned_job = &job->returned_user_job_ptr;
+	tracker->priority = priority;
+	if (watchdog < 0)
+		tracker->watchdog = limare_jobs_watchdog_get(state->jobs);
+	else
+		tracker->watchdog = watchdog;
 
 	job->fd = state->fd;
-	job->user_job_ptr = (unsigned int) job;
-	job->priority = 1;
-	job->watchdog_msecs = 0;
-	job->abort_id = 0;
-
-	ret = ioctl(state->fd, LIMA_M200_PP_START_JOB, job);
-	if (ret == -1) {
-		printf("%s: Error: failed to start job: %s\n",
-		       __func__, strerror(errno));
-		return errno;
-	}
+	job->user_job_ptr = (unsigned int) tracker;
+	job->priority = priority;
+	job->watchdog_msecs = tracker->watchdog;
+	job->abort_id = (unsigned int) tracker;
+
+	limare_jobs_queue(state->jobs, tracker);
+
+	if (fence)
+		*fence = tracker;
 
 	return 0;
 }
 
 int
 limare_m400_pp_job_start_direct(struct limare_state *state,
-				struct lima_m400_pp_job_start *job)
+				struct lima_m400_pp_job_start *job,
+				int priority, int watchdog,
+				struct limare_fence *after,
+				struct limare_fence **fence)
 {
-	int ret;
+	struct limare_fence *tracker;
 
-	limare_jobs_wait();
+	tracker = limare_fence_create(LIMARE_JOB_PP, LIMA_M400_PP_START_JOB,
+				      job, after, fence != NULL);
+	if (!tracker) {
+		free(job);
+		return -ENOMEM;
+	}
 
-	wait_for_notification_start(state);
+	tracker->start_status = &job->status;
+	tracker->returned_job = &job->returned_user_job_ptr;
+	tracker->priority = priority;
+	if (watchdog < 0)
+		tracker->watchdog = limare_jobs_watchdog_get(state->jobs);
+	else
+		tracker->watchdog = watchdog;
 
 	job->fd = state->fd;
-	job->user_job_ptr = (unsigned int) job;
-	job->priority = 1;
-	job->watchdog_msecs = 0;
-	job->abort_id = 0;
-
-	ret = ioctl(state->fd, LIMA_M400_PP_START_JOB, job);
-	if (ret == -1) {
-		printf("%s: Error: failed to start job: %s\n",
-		       __func__, strerror(errno));
-		return errno;
-	}
+	job->user_job_ptr = (unsigned int) tracker;
+	job->priority = priority;
+	job->watchdog_msecs = tracker->watchdog;
+	job->abort_id = (unsigned int) tracker;
+
+	limare_jobs_queue(state->jobs, tracker);
+
+	if (fence)
+		*fence = tracker;
 
 	return 0;
 }
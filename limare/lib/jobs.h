@@ -22,17 +22,101 @@
  */
 
 /*
- * Simplistic job handling.
+ * Job handling: jobs are queued per core, and are tracked until the
+ * notification thread has seen them finish.
  */
 
 #ifndef LIMARE_JOBS_H
 #define LIMARE_JOBS_H 1
 
-void limare_jobs_wait(void);
-void wait_for_notification_start(struct limare_state *state);
+struct lima_gp_job_start;
+struct lima_m200_pp_job_start;
+struct lima_m400_pp_job_start;
 
-int limare_gp_job_start_direct(struct limare_state *state, struct lima_gp_job_start *job);
-int limare_m200_pp_job_start_direct(struct limare_state *state, struct lima_m200_pp_job_start *job);
-int limare_m400_pp_job_start_direct(struct limare_state *state, struct lima_m400_pp_job_start *job);
+/* the cores we hand jobs to. */
+#define LIMARE_JOB_GP 0
+#define LIMARE_JOB_PP 1
+#define LIMARE_JOB_CORES 2
+
+/* how many jobs can run on one type of core at once, for Mali-400 MP. */
+#define LIMARE_JOB_SLOTS_MAX 4
+
+/*
+ * The kernel aborts jobs that run longer than the watchdog. Should the
+ * kernel not get to it, we abort them ourselves after the grace period.
+ */
+#define LIMARE_JOB_WATCHDOG_DEFAULT 2000
+#define LIMARE_JOB_ABORT_GRACE 500
+
+/*
+ * Tracks a job from submission until it has finished, its address is the
+ * user_job_ptr of the job. Only touched with the jobs mutex held.
+ */
+struct limare_fence {
+	int core; /* -1 for merged fences, which have no job */
+	unsigned long request; /* start ioctl */
+	void *job; /* as handed to the kernel, freed once finished */
+	enum lima_job_start_status *start_status; /* inside job */
+	unsigned int *returned_job; /* inside job */
+
+	int priority; /* lower is more urgent */
+
+	/* only start once this one has finished successfully. */
+	struct limare_fence *after;
+
+	/* signal this one too, once all that were merged into it are done. */
+	struct limare_fence *merge;
+	int merge_pending;
+
+	/* for the watchdog: when the job was handed to the kernel, in ms. */
+	long long started;
+	int watchdog; /* ms, 0 means none */
+	int abort_sent;
+
+	int signaled;
+	unsigned int status; /* _mali_uk_job_status */
+
+	/* what the kernel told us about the job, for when it failed. */
+	unsigned int irq_status;
+	unsigned int stop_address[2]; /* gp: vs, plbu. pp: last tile list */
+
+	void (*callback)(struct limare_fence *fence, unsigned int status,
+			 void *data);
+	void *callback_data;
+	int callback_done;
+
+	/* one for the job tracking, one for whoever asked for the fence. */
+	int refcount;
+
+	struct limare_fence *next;
+};
+
+struct limare_jobs *limare_jobs_create(struct limare_state *state);
+void limare_jobs_destroy(struct limare_jobs *jobs);
+
+void limare_jobs_wait(struct limare_state *state);
+int limare_jobs_event_fd(struct limare_state *state);
+void limare_jobs_dispatch(struct limare_state *state);
+void limare_fence_ref(struct limare_state *state, struct limare_fence *fence);
+int limare_fence_error(unsigned int status);
+struct limare_fence *limare_fence_merge(struct limare_state *state,
+					struct limare_fence **fences,
+					int count);
+
+int limare_gp_job_start_direct(struct limare_state *state,
+			       struct lima_gp_job_start *job,
+			       int priority, int watchdog,
+			       struct limare_fence *after,
+			       struct limare_fence **fence);
+int limare_m200_pp_job_start_direct(struct limare_state *state,
+				    struct lima_m200_pp_job_start *job,
+				    int priority, int watchdog,
+				    struct limare_fence *after,
+				    struct limare_fence **fence);
+int limare_m400_pp_job_start_direct(struct limare_state *state,
+				    struct lima_m400_pp_job_start *job,
+				    int priority, int watchdog,
+				    struct limare_fence *after,
+				    struct limare_fence **fence);
 
 #endif /* LIMARE_JOBS_H */
@@ -23,11 +23,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <fcntl.h>
+#include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #define u32 uint32_t
 #include "linux/mali_ioctl.h"
@@ -39,103 +38,104 @@
 #include "jobs.h"
 #include "symbols.h"
 #include "compiler.h"
+#include "mem.h"
+#include "uniforms.h"
+#include "arena.h"
+#include "backend.h"
+#include "decode.h"
+#include "reference.h"
+#include "record.h"
 
+/*
+ * Maps our window of mali memory, everything else gets carved out of it
+ * through limare_mem_alloc().
+ */
 static int
-limare_fd_open(struct limare_state *state)
+limare_mem_init(struct limare_state *state)
 {
-	state->fd = open("/dev/mali", O_RDWR);
-	if (state->fd == -1) {
-		printf("Error: Failed to open /dev/mali: %s\n",
-		       strerror(errno));
-		return errno;
-	}
+	int ret;
+
+	ret = state->backend->mem_init(state, &state->mem_physical);
+	if (ret)
+		return ret;
+
+	state->mem_size = 0x100000;
+	state->mem_address = state->backend->mmap(state, state->mem_physical,
+						  state->mem_size);
+	if (!state->mem_address)
+		return -1;
+
+	state->mem_heap = mem_heap_create(state->mem_physical,
+					  state->mem_address, state->mem_size);
+	if (!state->mem_heap)
+		return -1;
+
+	state->mem_total = state->mem_size;
 
 	return 0;
 }
 
-static int
-limare_gpu_detect(struct limare_state *state)
+/*
+ * Hands back all our gpu memory, whatever still lives in it.
+ */
+static void
+limare_mem_fini(struct limare_state *state)
 {
-	_mali_uk_get_system_info_size_s system_info_size;
-	_mali_uk_get_system_info_s system_info_ioctl;
-	struct _mali_system_info *system_info;
-	int ret;
+	const struct limare_backend *backend = state->backend;
 
-	ret = ioctl(state->fd, MALI_IOC_GET_SYSTEM_INFO_SIZE,
-		    &system_info_size);
-	if (ret) {
-		printf("Error: %s: ioctl(GET_SYSTEM_INFO_SIZE) failed: %s\n",
-		       __func__, strerror(ret));
-		return ret;
-	}
+	while (state->mem_deferred) {
+		struct mem_deferred *deferred = state->mem_deferred;
 
-	system_info_ioctl.size = system_info_size.size;
-	system_info_ioctl.system_info = calloc(1, system_info_size.size);
-	if (!system_info_ioctl.system_info) {
-		printf("%s: Error: failed to allocate system info: %s\n",
-		       __func__, strerror(errno));
-		return errno;
+		state->mem_deferred = deferred->next;
+		free(deferred);
 	}
 
-	ret = ioctl(state->fd, MALI_IOC_GET_SYSTEM_INFO, &system_info_ioctl);
-	if (ret) {
-		printf("%s: Error: ioctl(GET_SYSTEM_INFO) failed: %s\n",
-		       __func__, strerror(ret));
-		free(system_info_ioctl.system_info);
-		return ret;
-	}
+	if (state->mem_heap) {
+		while (state->mem_heap->next) {
+			struct mem_heap *heap = state->mem_heap->next;
+
+			state->mem_heap->next = heap->next;
 
-	system_info = system_info_ioctl.system_info;
+			backend->munmap(state, heap->address, heap->size);
+			backend->big_block_free(state, heap->cookie);
+			mem_heap_destroy(heap);
+		}
 
-	switch (system_info->core_info->type) {
-	case _MALI_GP2:
-	case _MALI_200:
-		printf("Detected Mali-200.\n");
-		state->type = 200;
-		break;
-	case _MALI_400_GP:
-	case _MALI_400_PP:
-		printf("Detected Mali-400.\n");
-		state->type = 400;
-		break;
-	default:
-		break;
+		mem_heap_destroy(state->mem_heap);
+		state->mem_heap = NULL;
 	}
 
-	return 0;
+	if (state->mem_address) {
+		backend->munmap(state, state->mem_address, state->mem_size);
+		state->mem_address = NULL;
+	}
+
+	state->mem_total = 0;
+	state->mem_used = 0;
 }
 
 /*
- * TODO: MEMORY MANAGEMENT!!!!!!!!!
- *
+ * The simulated backend gets picked with LIMARE_BACKEND=sim.
  */
-static int
-limare_mem_init(struct limare_state *state)
+static const struct limare_backend *
+limare_backend_select(void)
 {
-	_mali_uk_init_mem_s mem_init = { 0 };
-	int ret;
+	const struct limare_backend *backends[] = {
+		&limare_backend_mali,
+		&limare_backend_sim,
+	};
+	const char *name = getenv("LIMARE_BACKEND");
+	int i;
 
-	mem_init.ctx = (void *) state->fd;
-	mem_init.mali_address_base = 0;
-	mem_init.memory_size = 0;
-	ret = ioctl(state->fd, MALI_IOC_MEM_INIT, &mem_init);
-	if (ret == -1) {
-		printf("Error: ioctl MALI_IOC_MEM_INIT failed: %s\n",
-		       strerror(errno));
-		return errno;
-	}
+	if (!name)
+		return &limare_backend_mali;
 
-	state->mem_physical = mem_init.mali_address_base;
-	state->mem_size = 0x100000;
-	state->mem_address = mmap(NULL, state->mem_size, PROT_READ | PROT_WRITE,
-				  MAP_SHARED, state->fd, state->mem_physical);
-	if (state->mem_address == MAP_FAILED) {
-		printf("Error: failed to mmap offset 0x%x (0x%x): %s\n",
-		       state->mem_physical, state->mem_size, strerror(errno));
-		return errno;
-	}
+	for (i = 0; i < 2; i++)
+		if (!strcmp(name, backends[i]->name))
+			return backends[i];
 
-	return 0;
+	printf("%s: Error: unknown backend \"%s\"\n", __func__, name);
+	return NULL;
 }
 
 struct limare_state *
@@ -151,11 +151,18 @@ limare_init(void)
 		goto error;
 	}
 
-	ret = limare_fd_open(state);
+	state->thread = pthread_self();
+	state->fd = -1;
+
+	state->backend = limare_backend_select();
+	if (!state->backend)
+		goto error;
+
+	ret = state->backend->open(state);
 	if (ret)
 		goto error;
 
-	ret = limare_gpu_detect(state);
+	ret = state->backend->system_info(state);
 	if (ret)
 		goto error;
 
@@ -163,45 +170,161 @@ limare_init(void)
 	if (ret)
 		goto error;
 
+	state->jobs = limare_jobs_create(state);
+	if (!state->jobs)
+		goto error;
+
 	return state;
  error:
-	free(state);
+	limare_fini(state);
 	return NULL;
 }
 
-/* here we still hardcode our memory addresses. */
+/*
+ * Hand the state over to the calling thread. The thread which used it
+ * before must be done with it.
+ */
+int
+limare_thread_attach(struct limare_state *state)
+{
+	state->thread = pthread_self();
+
+	return 0;
+}
+
+/*
+ * Catch calls from threads that do not own the state.
+ */
+int
+limare_thread_check(struct limare_state *state, const char *caller)
+{
+	if (pthread_equal(state->thread, pthread_self()))
+		return 0;
+
+	printf("%s: Error: state is owned by another thread.\n", caller);
+	return -EPERM;
+}
+
+/*
+ * Frame slots hold what the gpu is still using when the next frame is
+ * already being built. The state members are what the current frame uses.
+ */
+static void
+limare_frame_slot_save(struct limare_state *state, int index)
+{
+	struct limare_frame_slot *slot = &state->slots[index];
+
+	slot->plb = state->plb;
+
+	slot->vs_commands = state->vs_commands;
+	slot->vs_commands_physical = state->vs_commands_physical;
+	slot->vs_commands_size = state->vs_commands_size;
+
+	slot->plbu_commands = state->plbu_commands;
+	slot->plbu_commands_physical = state->plbu_commands_physical;
+	slot->plbu_commands_size = state->plbu_commands_size;
+}
+
+static void
+limare_frame_slot_load(struct limare_state *state, int index)
+{
+	struct limare_frame_slot *slot = &state->slots[index];
+
+	state->plb = slot->plb;
+
+	state->vs_commands = slot->vs_commands;
+	state->vs_commands_physical = slot->vs_commands_physical;
+	state->vs_commands_size = slot->vs_commands_size;
+
+	state->plbu_commands = slot->plbu_commands;
+	state->plbu_commands_physical = slot->plbu_commands_physical;
+	state->plbu_commands_size = slot->plbu_commands_size;
+}
+
 int
 limare_state_setup(struct limare_state *state, int width, int height,
 		    unsigned int clear_color)
 {
+	unsigned int physical;
+	void *address;
+	int i;
+
 	if (!state)
 		return -1;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	state->width = width;
 	state->height = height;
 
 	state->clear_color = clear_color;
 
-	/* first, set up the plb, this is unchanged between draws. */
-	state->plb = plb_create(state, state->mem_physical, state->mem_address,
-				0x00000, 0x80000);
-	if (!state->plb)
-		return -1;
+	if (state->pipeline) {
+		/*
+		 * Each slot can have a frame being rendered, and the frame
+		 * handed out by limare_frame_last() must not be one of them.
+		 */
+		if (!state->frame_count)
+			state->frame_count = LIMARE_FRAME_SLOTS + 1;
+		if (state->frame_count < (LIMARE_FRAME_SLOTS + 1)) {
+			printf("%s: Error: pipelining needs at least %d frames\n",
+			       __func__, LIMARE_FRAME_SLOTS + 1);
+			return -1;
+		}
+		state->slot_count = LIMARE_FRAME_SLOTS;
+	} else {
+		if (!state->frame_count)
+			state->frame_count = 2;
+		state->slot_count = 1;
+	}
+
+	/*
+	 * Each frame that can be in flight has its own plb and command
+	 * queues, these are unchanged between draws.
+	 */
+	for (i = 0; i < state->slot_count; i++) {
+		state->plb = plb_create(state);
+		if (!state->plb)
+			return -1;
+
+		if (vs_command_queue_create(state, 0x4000) ||
+		    plbu_command_queue_create(state, 0x4000))
+			return -1;
+
+		limare_frame_slot_save(state, i);
+	}
+
+	state->slot = 0;
+	limare_frame_slot_load(state, state->slot);
+	state->frame_ready = 1;
 
 	/* now add the area for the pp, again, unchanged between draws. */
-	state->pp = pp_info_create(state, state->mem_address + 0x80000,
-				   state->mem_physical + 0x80000,
-				   0x1000, state->mem_physical + 0x100000);
+	state->pp = pp_info_create(state);
 	if (!state->pp)
 		return -1;
 
-	/* now the two command queues */
-	if (vs_command_queue_create(state, 0x81000, 0x4000) ||
-	    plbu_command_queue_create(state, 0x85000, 0x4000))
+	/* and the ring from which our draws take their memory. */
+	if (!state->draw_mem_size)
+		state->draw_mem_size = 0x80000;
+
+	address = limare_mem_alloc(state, state->draw_mem_size,
+				   MEM_ALIGN_PAGE, &physical);
+	if (!address)
+		return -1;
+
+	state->draw_ring = mem_ring_create(physical, address,
+					   state->draw_mem_size);
+	if (!state->draw_ring)
+		return -1;
+
+	state->uniform_cache = uniform_cache_create();
+	if (!state->uniform_cache)
 		return -1;
 
-	state->draw_mem_offset = 0x90000;
-	state->draw_mem_size = 0x70000;
+	state->frame_arena = arena_create(0x10000);
+	if (!state->frame_arena)
+		return -1;
 
 	return 0;
 }
@@ -212,6 +335,9 @@ limare_uniform_attach(struct limare_state *state, char *name, int size,
 {
 	int found = 0, i;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	for (i = 0; i < state->vertex_uniform_count; i++) {
 		struct symbol *symbol = state->vertex_uniforms[i];
 
@@ -261,6 +387,9 @@ limare_attribute_pointer(struct limare_state *state, char *name, int size,
 {
 	int i;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	for (i = 0; i < state->vertex_attribute_count; i++) {
 		struct symbol *symbol = state->vertex_attributes[i];
 
@@ -268,6 +397,8 @@ limare_attribute_pointer(struct limare_state *state, char *name, int size,
 			if (symbol->component_size == size) {
 				symbol->component_count = count;
 				symbol->data = data;
+				symbol->data_physical = 0;
+				symbol->data_streamed = 0;
 				return 0;
 			}
 
@@ -282,6 +413,153 @@ limare_attribute_pointer(struct limare_state *state, char *name, int size,
 	return -1;
 }
 
+/*
+ * Buffer objects live in gpu memory, so that data which does not change
+ * between frames only gets copied once. The caller has to make sure that
+ * the gpu is done with a buffer before changing or destroying it.
+ */
+struct limare_buffer *
+limare_buffer_create(struct limare_state *state, int size)
+{
+	struct limare_buffer *buffer;
+
+	if (limare_thread_check(state, __func__))
+		return NULL;
+
+	buffer = calloc(1, sizeof(struct limare_buffer));
+	if (!buffer) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	buffer->address = limare_mem_alloc(state, size, MEM_ALIGN_DEFAULT,
+					   &buffer->physical);
+	if (!buffer->address) {
+		printf("%s: Error: no gpu memory for 0x%x bytes\n",
+		       __func__, size);
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->size = size;
+
+	return buffer;
+}
+
+int
+limare_buffer_upload(struct limare_buffer *buffer, int offset,
+		     void *data, int size)
+{
+	if ((offset < 0) || ((offset + size) > buffer->size)) {
+		printf("%s: Error: 0x%x bytes at 0x%x do not fit in 0x%x\n",
+		       __func__, size, offset, buffer->size);
+		return -1;
+	}
+
+	memcpy(buffer->address + offset, data, size);
+
+	return 0;
+}
+
+void
+limare_buffer_destroy(struct limare_state *state,
+		      struct limare_buffer *buffer)
+{
+	if (limare_thread_check(state, __func__))
+		return;
+
+	limare_mem_free(state, buffer->physical);
+	free(buffer);
+}
+
+int
+limare_attribute_buffer(struct limare_state *state, char *name, int size,
+			int count, struct limare_buffer *buffer, int offset)
+{
+	int i;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	if ((offset < 0) || (offset >= buffer->size)) {
+		printf("%s: Error: offset 0x%x is outside the buffer\n",
+		       __func__, offset);
+		return -1;
+	}
+
+	for (i = 0; i < state->vertex_attribute_count; i++) {
+		struct symbol *symbol = state->vertex_attributes[i];
+
+		if (!strcmp(symbol->name, name)) {
+			if (symbol->component_size == size) {
+				symbol->component_count = count;
+				symbol->data = buffer->address + offset;
+				symbol->data_physical =
+					buffer->physical + offset;
+				symbol->data_streamed = 0;
+				return 0;
+			}
+
+			printf("%s: Error: Attribute %s has different dimensions\n",
+			       __func__, name);
+			return -1;
+		}
+	}
+
+	printf("%s: Error: Unable to find attribute %s\n",
+	       __func__, name);
+	return -1;
+}
+
+/*
+ * Hands out frame memory for an attribute, for the caller to write its
+ * vertices into directly. This memory is only valid until the next flush,
+ * after which the attribute needs new data.
+ */
+void *
+limare_attribute_stream(struct limare_state *state, char *name, int size,
+			int count, int entries)
+{
+	struct mem_ring *ring = state->draw_ring;
+	int i, offset;
+
+	if (limare_thread_check(state, __func__))
+		return NULL;
+
+	for (i = 0; i < state->vertex_attribute_count; i++) {
+		struct symbol *symbol = state->vertex_attributes[i];
+
+		if (strcmp(symbol->name, name))
+			continue;
+
+		if (symbol->component_size != size) {
+			printf("%s: Error: Attribute %s has different dimensions\n",
+			       __func__, name);
+			return NULL;
+		}
+
+		offset = mem_ring_alloc(ring, size * count * entries,
+					MEM_ALIGN_DEFAULT);
+		if (offset < 0) {
+			printf("%s: Error: no frame memory left for %s\n",
+			       __func__, name);
+			return NULL;
+		}
+
+		symbol->component_count = count;
+		symbol->data = ring->address + offset;
+		symbol->data_physical = ring->physical + offset;
+		symbol->data_streamed = 1;
+
+		return symbol->data;
+	}
+
+	printf("%s: Error: Unable to find attribute %s\n",
+	       __func__, name);
+	return NULL;
+}
+
 int
 limare_gl_mali_ViewPortTransform(struct limare_state *state,
 				  struct symbol *symbol)
@@ -316,19 +594,42 @@ limare_gl_mali_ViewPortTransform(struct limare_state *state,
 	return 0;
 }
 
+static int limare_frame_prepare(struct limare_state *state);
+
 int
 limare_draw_arrays(struct limare_state *state, int mode, int start, int count)
 {
 	struct draw_info *draw;
 	int i;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	if (!state->plb) {
 		printf("%s: Error: plb member is not set up yet.\n", __func__);
 		return -1;
 	}
 
+	if (limare_frame_prepare(state))
+		return -1;
+
+	for (i = 0; i < state->vertex_attribute_count; i++) {
+		struct symbol *symbol = state->vertex_attributes[i];
 
-	/* Todo, check whether attributes all have data attached! */
+		if (!symbol->data) {
+			printf("%s: Error: attribute %s has no data attached.\n",
+			       __func__, symbol->name);
+			return -1;
+		}
+
+		/* frame memory would be gone by the time this is replayed. */
+		if (state->recording && symbol->data_streamed &&
+		    !record_address(state->recording, symbol->data_physical)) {
+			printf("%s: Error: attribute %s was streamed before "
+			       "recording.\n", __func__, symbol->name);
+			return -1;
+		}
+	}
 
 	for (i = 0; i < state->vertex_uniform_count; i++) {
 		struct symbol *symbol = state->vertex_uniforms[i];
@@ -347,91 +648,777 @@ limare_draw_arrays(struct limare_state *state, int mode, int start, int count)
 		}
 	}
 
-	if (state->draw_count >= 32) {
-		printf("%s: Error: too many draws already!\n", __func__);
-		return -1;
+	if (state->draw_count == state->draw_size) {
+		struct draw_info **draws;
+		int size = state->draw_size ? (2 * state->draw_size) : 32;
+
+		draws = realloc(state->draws, size * sizeof(struct draw_info *));
+		if (!draws) {
+			printf("%s: Error: failed to grow draw list: %s\n",
+			       __func__, strerror(errno));
+			return -1;
+		}
+
+		state->draws = draws;
+		state->draw_size = size;
+		state->stats.allocations++;
 	}
 
-	if (state->draw_mem_size < 0x1000) {
+	draw = draw_create_new(state, draw_mem_size(state, count),
+			       mode, start, count);
+	if (!draw) {
 		printf("%s: Error: no more space available!\n", __func__);
 		return -1;
 	}
 
-	draw = draw_create_new(state, state->draw_mem_offset, 0x1000,
-			       mode, start, count);
 	state->draws[state->draw_count] = draw;
-
-	state->draw_mem_offset += 0x1000;
-	state->draw_mem_size -= 0x1000;
 	state->draw_count++;
+	state->stats.draws++;
 
-	vs_info_attach_shader(draw, state->vertex_binary->shader,
+	vs_info_attach_shader(draw, state->vertex_shader,
+			      state->vertex_shader_physical,
 			      state->vertex_binary->shader_size / 16);
 
-	plbu_info_attach_shader(draw, state->fragment_binary->shader,
+	plbu_info_attach_shader(draw, state->fragment_shader,
+				state->fragment_shader_physical,
 				state->fragment_binary->shader_size / 4);
 
 	for (i = 0; i < state->vertex_attribute_count; i++) {
 		struct symbol *symbol =
-			symbol_copy(state->vertex_attributes[i], start, count);
+			symbol_copy(state->frame_arena,
+				    state->vertex_attributes[i], start, count);
 
-		if (symbol)
-			vs_info_attach_attribute(draw, symbol);
+		if (!symbol)
+			continue;
+
+		state->stats.allocations++;
+		state->stats.bytes_copied += sizeof(struct symbol);
 
+		/* attributes not in gpu memory yet get copied into the draw. */
+		if (!symbol->data_physical)
+			state->stats.bytes_copied += symbol->size;
+
+		vs_info_attach_attribute(draw, symbol);
 	}
 
 	for (i = 0; i < state->vertex_varying_count; i++) {
 		struct symbol *symbol =
-			symbol_copy(state->vertex_varyings[i], 0, count);
+			symbol_copy(state->frame_arena,
+				    state->vertex_varyings[i], 0, count);
 
-		if (symbol)
-			vs_info_attach_varying(draw, symbol);
+		if (!symbol)
+			continue;
+
+		state->stats.allocations++;
+		state->stats.bytes_copied += sizeof(struct symbol);
+
+		vs_info_attach_varying(draw, symbol);
 	}
 
-	if (vs_info_attach_uniforms(draw, state->vertex_uniforms,
+	if (vs_info_attach_uniforms(state, draw, state->vertex_uniforms,
 				    state->vertex_uniform_count,
 				    state->vertex_uniform_size))
 		return -1;
 
-	if (plbu_info_attach_uniforms(draw, state->fragment_uniforms,
+	if (plbu_info_attach_uniforms(state, draw, state->fragment_uniforms,
 				      state->fragment_uniform_count,
 				      state->fragment_uniform_size))
 		return -1;
 
-	vs_commands_draw_add(state, draw);
+	if (vs_commands_draw_add(state, draw))
+		return -1;
 	vs_info_finalize(state, draw->vs);
 
 	plbu_info_render_state_create(draw);
-	plbu_commands_draw_add(state, draw);
+	if (plbu_commands_draw_add(state, draw))
+		return -1;
+
+	if (state->recording)
+		return record_draw_add(state, state->recording, draw);
 
 	return 0;
 }
 
+/*
+ * Hand back frames that the gpu is done with, oldest first, up to and
+ * including serial. Without wait, this stops at the first frame that is
+ * still being rendered. Frames which failed to render are retired too,
+ * but the last good frame stays current, and the error is kept around for
+ * the next limare_flush() or limare_wait() to report.
+ */
+static int
+limare_frames_retire(struct limare_state *state, unsigned int serial,
+		     int wait)
+{
+	struct limare_frame_slot *oldest;
+	int i, ret;
+
+	while (1) {
+		oldest = NULL;
+		for (i = 0; i < state->slot_count; i++) {
+			struct limare_frame_slot *slot = &state->slots[i];
+
+			if (!slot->fence)
+				continue;
+
+			if (!oldest || ((int) (slot->serial - oldest->serial) < 0))
+				oldest = slot;
+		}
+
+		if (!oldest || ((int) (serial - oldest->serial) < 0))
+			break;
+
+		if (!wait && !limare_fence_query(state, oldest->fence))
+			break;
+
+		ret = limare_fence_wait(state, oldest->fence, -1);
+		if (ret && !limare_fence_query(state, oldest->fence))
+			return ret;
+
+		limare_fence_release(state, oldest->fence);
+		oldest->fence = NULL;
+
+		if (ret) {
+			printf("%s: Error: frame %u failed: %s\n", __func__,
+			       oldest->serial, strerror(-ret));
+			state->frame_error = ret;
+		} else
+			pp_info_frame_done(state->pp, oldest->frame_index);
+
+		/* its draw memory can now be reused. */
+		mem_ring_retire(state->draw_ring, oldest->serial);
+		limare_mem_retire(state, oldest->serial);
+	}
+
+	limare_mem_trim(state);
+
+	return 0;
+}
+
+/*
+ * Report, once, that a frame failed to render since we last asked.
+ */
+static int
+limare_frame_error_take(struct limare_state *state)
+{
+	int error = state->frame_error;
+
+	state->frame_error = 0;
+
+	return error;
+}
+
+/*
+ * Before a frame gets built in a slot, the gpu has to be done with what was
+ * last rendered from that slot.
+ */
+static int
+limare_frame_prepare(struct limare_state *state)
+{
+	struct limare_frame_slot *slot = &state->slots[state->slot];
+	int ret;
+
+	if (state->frame_ready)
+		return 0;
+
+	if (slot->fence) {
+		ret = limare_frames_retire(state, slot->serial, 1);
+		if (ret)
+			return ret;
+	}
+
+	/* pick up whatever else has finished in the meantime. */
+	ret = limare_frames_retire(state, state->frame_serial, 0);
+	if (ret)
+		return ret;
+
+	vs_commands_start(state);
+	plbu_commands_start(state);
+
+	state->frame_ready = 1;
+
+	return 0;
+}
+
+/*
+ * Drop the draws of the frame we just submitted, and move on to the next
+ * slot. The slot itself gets prepared once it is needed.
+ */
+static void
+limare_frame_new(struct limare_state *state)
+{
+	int i;
+
+	/* draws and their symbol copies all live in the arena. */
+	arena_reset(state->frame_arena);
+	state->draw_count = 0;
+
+	/* streamed attributes only belonged to the frame we just submitted. */
+	for (i = 0; i < state->vertex_attribute_count; i++) {
+		struct symbol *symbol = state->vertex_attributes[i];
+
+		if (symbol->data_streamed) {
+			symbol->data = NULL;
+			symbol->data_physical = 0;
+			symbol->data_streamed = 0;
+		}
+	}
+
+	uniform_cache_reset(state->uniform_cache);
+
+	limare_frame_slot_save(state, state->slot);
+	state->slot = (state->slot + 1) % state->slot_count;
+	limare_frame_slot_load(state, state->slot);
+
+	state->frame_ready = 0;
+	state->frame_serial++;
+}
+
+/*
+ * Hands the frame to the gpu, and returns right away. The returned fence
+ * signals when the frame has been rendered, and needs to be released.
+ *
+ * The priority is one of LIMARE_PRIORITY_*, and the watchdog is how many ms
+ * the frame may take on each core, with 0 meaning forever.
+ */
+struct limare_fence *
+limare_flush_submit(struct limare_state *state, int priority, int watchdog)
+{
+	struct limare_frame_slot *slot;
+	struct limare_fence *gp_fence, *pp_fence;
+	int plbu_count, ret;
+
+	if (limare_thread_check(state, __func__))
+		return NULL;
+
+	if (state->recording) {
+		printf("%s: Error: still recording.\n", __func__);
+		return NULL;
+	}
+
+	if (limare_frame_prepare(state))
+		return NULL;
+
+	/*
+	 * Should the frame not make it to the gpu, all this gets undone, so
+	 * that it can be flushed again, or added to.
+	 */
+	plbu_count = state->plbu_commands_count;
+
+	if (plbu_commands_finish(state))
+		return NULL;
+
+	if (mem_ring_frame_end(state->draw_ring, state->frame_serial))
+		goto undo_commands;
+
+	if (limare_gp_job_start(state, priority, watchdog, &gp_fence))
+		goto undo_ring;
+
+	/* the pp needs the plb streams which the gp is writing out. */
+	ret = limare_pp_job_start(state, state->pp, state->plb, priority,
+				  watchdog, gp_fence, &pp_fence);
+	if (ret) {
+		/* nothing tracks the gp job now, so let it finish first. */
+		limare_fence_wait(state, gp_fence, -1);
+		limare_fence_release(state, gp_fence);
+		goto undo_ring;
+	}
+	limare_fence_release(state, gp_fence);
+
+	state->stats.flushes++;
+
+	slot = &state->slots[state->slot];
+	slot->fence = pp_fence;
+	slot->serial = state->frame_serial;
+	slot->frame_index = state->pp->frame_pending;
+
+	/* one reference for the slot, one for the caller. */
+	limare_fence_ref(state, pp_fence);
+
+	limare_frame_new(state);
+
+	return pp_fence;
+
+ undo_ring:
+	mem_ring_frame_undo(state->draw_ring);
+ undo_commands:
+	state->plbu_commands_count = plbu_count;
+	return NULL;
+}
+
+struct limare_fence *
+limare_flush_async(struct limare_state *state)
+{
+	return limare_flush_submit(state, LIMARE_PRIORITY_NORMAL,
+				   LIMARE_WATCHDOG_DEFAULT);
+}
+
+/*
+ * When pipelining, this returns right away too, so that the next frame
+ * gets built while this one renders. Otherwise the frame is done when this
+ * returns.
+ */
 int
 limare_flush(struct limare_state *state)
 {
+	struct limare_fence *fence;
+	unsigned int serial = state->frame_serial;
 	int ret;
 
-	plbu_commands_finish(state);
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	fence = limare_flush_async(state);
+	if (!fence)
+		return -1;
+
+	limare_fence_release(state, fence);
+
+	if (!state->pipeline) {
+		ret = limare_frames_retire(state, serial, 1);
+		if (ret)
+			return ret;
+	}
+
+	return limare_frame_error_take(state);
+}
+
+/*
+ * For clients with their own event loop: this file descriptor becomes
+ * readable when the gpu finishes a job, after which limare_dispatch()
+ * should be called.
+ */
+int
+limare_event_fd(struct limare_state *state)
+{
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
 
-	ret = limare_gp_job_start(state);
+	return limare_jobs_event_fd(state);
+}
+
+/*
+ * Run the callbacks of all finished fences, and retire all frames that
+ * have finished rendering. This never blocks.
+ */
+int
+limare_dispatch(struct limare_state *state)
+{
+	int ret;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	limare_jobs_dispatch(state);
+
+	ret = limare_frames_retire(state, state->frame_serial, 0);
 	if (ret)
 		return ret;
 
-	ret = limare_pp_job_start(state, state->pp);
+	return limare_frame_error_take(state);
+}
+
+/*
+ * Wait until the gpu is done with all frames that were flushed.
+ */
+int
+limare_wait(struct limare_state *state)
+{
+	int ret;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	ret = limare_frames_retire(state, state->frame_serial - 1, 1);
 	if (ret)
 		return ret;
 
-	limare_jobs_wait();
+	return limare_frame_error_take(state);
+}
 
-	return 0;
+/*
+ * The frame which the last flush rendered, for reading back or presenting.
+ */
+void *
+limare_frame_last(struct limare_state *state, int *index)
+{
+	struct pp_info *pp = state->pp;
+
+	if (limare_thread_check(state, __func__))
+		return NULL;
+
+	if (index)
+		*index = pp->frame_last;
+
+	if (pp->frame_last < 0)
+		return NULL;
+
+	return pp->frames[pp->frame_last].address;
 }
 
 /*
- * Just run fflush(stdout) to give the wrapper library a chance to finish.
+ * The frame which the next flush will render to.
  */
+int
+limare_frame_next(struct limare_state *state)
+{
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	return state->pp->frame_current;
+}
+
+void
+limare_uniform_stats_print(struct limare_state *state)
+{
+	uniform_cache_print(state->uniform_cache);
+}
+
+void
+limare_stats_get(struct limare_state *state, struct limare_stats *stats)
+{
+	*stats = state->stats;
+}
+
+/*
+ * Have every gp job decoded on the cpu before it gets submitted, so that
+ * the cost of our command streams can be looked at without hardware.
+ */
+int
+limare_command_stats_enable(struct limare_state *state)
+{
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	if (state->decode)
+		return 0;
+
+	state->decode = decode_create();
+	if (!state->decode)
+		return -ENOMEM;
+
+	return 0;
+}
+
 void
-limare_finish(void)
+limare_command_stats_print(struct limare_state *state, int draws)
+{
+	if (state->decode)
+		decode_print(state->decode, draws);
+}
+
+/*
+ * Renders the last flushed frame on the cpu, into a buffer laid out like
+ * the frame the pp wrote. This needs limare_command_stats_enable() to have
+ * been called before the frame was flushed, it needs to happen before the
+ * next draw, and it needs the real hardware to have run the gp. Waits for
+ * the frame to finish.
+ */
+int
+limare_reference_render(struct limare_state *state, void *buffer,
+			int thread_count)
+{
+	int ret;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	if (!state->decode || !state->decode->job_count) {
+		printf("%s: Error: no decoded frame to render.\n", __func__);
+		return -EINVAL;
+	}
+
+	if (state->backend == &limare_backend_sim) {
+		printf("%s: Error: the %s backend does not run vertex "
+		       "shaders.\n", __func__, state->backend->name);
+		return -ENODEV;
+	}
+
+	/* the gp outputs have to be there. */
+	ret = limare_frames_retire(state, state->frame_serial - 1, 1);
+	if (ret)
+		return ret;
+
+	return reference_render(state, state->decode, buffer, thread_count);
+}
+
+/*
+ * Wait for all rendering to finish, then run fflush(stdout) to give the
+ * wrapper library a chance to finish.
+ */
+int
+limare_finish(struct limare_state *state)
 {
+	int ret;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	ret = limare_wait(state);
+
 	fflush(stdout);
+
+	return ret;
+}
+
+/*
+ * Stops the notification thread, and frees the state with all of its
+ * memory. Rendering still in flight is waited for first, so the frame
+ * last rendered is gone after this.
+ */
+void
+limare_fini(struct limare_state *state)
+{
+	int i;
+
+	if (!state)
+		return;
+
+	if (limare_thread_check(state, __func__))
+		return;
+
+	if (state->jobs) {
+		if (state->pp)
+			limare_frames_retire(state, state->frame_serial - 1, 1);
+
+		for (i = 0; i < state->slot_count; i++)
+			if (state->slots[i].fence) {
+				limare_fence_release(state,
+						     state->slots[i].fence);
+				state->slots[i].fence = NULL;
+			}
+
+		limare_jobs_destroy(state->jobs);
+		state->jobs = NULL;
+	}
+
+	/* this also hands the draw ring back. */
+	if (state->recording)
+		record_destroy(state, state->recording);
+
+	if (state->frame_arena)
+		arena_destroy(state->frame_arena);
+	if (state->uniform_cache)
+		uniform_cache_destroy(state->uniform_cache);
+	if (state->decode)
+		decode_destroy(state->decode);
+	if (state->draw_ring)
+		mem_ring_destroy(state->draw_ring);
+
+	for (i = 0; i < state->slot_count; i++)
+		free(state->slots[i].plb);
+	free(state->pp);
+	free(state->draws);
+
+	/* the above all pointed into here. */
+	if (state->backend) {
+		limare_mem_fini(state);
+		state->backend->close(state);
+	}
+
+	free(state);
+}
+
+/*
+ * Until limare_record_end(), draws go into a recording instead of the
+ * frame. All their memory comes from the recording, size bytes of it, and
+ * attributes have to be in buffers, given as pointers, or streamed while
+ * recording. The recording belongs to the currently linked program.
+ */
+struct limare_recording *
+limare_record_begin(struct limare_state *state, int size)
+{
+	if (limare_thread_check(state, __func__))
+		return NULL;
+
+	if (state->recording) {
+		printf("%s: Error: already recording.\n", __func__);
+		return NULL;
+	}
+
+	if (!state->vertex_shader || !state->fragment_shader) {
+		printf("%s: Error: no program linked.\n", __func__);
+		return NULL;
+	}
+
+	if (limare_frame_prepare(state))
+		return NULL;
+
+	if (!size)
+		size = state->draw_mem_size;
+
+	state->recording = record_create(state, ALIGN(size, MEM_ALIGN_PAGE));
+
+	return state->recording;
+}
+
+int
+limare_record_end(struct limare_state *state)
+{
+	struct limare_recording *recording = state->recording;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	if (!recording) {
+		printf("%s: Error: not recording.\n", __func__);
+		return -1;
+	}
+
+	state->recording = NULL;
+
+	return record_finish(state, recording);
+}
+
+/*
+ * Adds the recorded draws to the current frame, this only copies the
+ * command words.
+ */
+int
+limare_replay(struct limare_state *state, struct limare_recording *recording)
+{
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	if (state->recording) {
+		printf("%s: Error: still recording.\n", __func__);
+		return -1;
+	}
+
+	if ((recording->vertex_binary != state->vertex_binary) ||
+	    (recording->fragment_binary != state->fragment_binary) ||
+	    (recording->program_serial != state->program_serial)) {
+		printf("%s: Error: recorded with a different program.\n",
+		       __func__);
+		return -1;
+	}
+
+	if (limare_frame_prepare(state))
+		return -1;
+
+	if (vs_commands_append(state, recording->vs_commands,
+			       recording->vs_count) ||
+	    plbu_commands_append(state, recording->plbu_commands,
+				 recording->plbu_count))
+		return -1;
+
+	/* a frame can only have moved on through a successful flush. */
+	if (recording->replayed &&
+	    (recording->serial != state->frame_serial)) {
+		recording->serial_submitted = recording->serial;
+		recording->submitted = 1;
+	}
+
+	recording->serial = state->frame_serial;
+	recording->replayed = 1;
+
+	state->stats.draws += recording->draw_count;
+	state->stats.bytes_copied +=
+		8 * (recording->vs_count + recording->plbu_count);
+
+	return 0;
+}
+
+/*
+ * The gpu might still be using a previous replay, in which case we need
+ * to wait before touching its memory. Replays in the current frame have
+ * not been submitted yet, and are simply affected as well, but the frame
+ * before them might still be rendering.
+ */
+static int
+limare_recording_idle(struct limare_state *state,
+		      struct limare_recording *recording)
+{
+	unsigned int serial;
+
+	if (!recording->replayed)
+		return 0;
+
+	if (recording->serial != state->frame_serial)
+		serial = recording->serial;
+	else if (recording->submitted)
+		serial = recording->serial_submitted;
+	else
+		return 0;
+
+	return limare_frames_retire(state, serial, 1);
+}
+
+/*
+ * Like limare_uniform_attach(), but for an already recorded draw, or for
+ * all of them when draw is -1. Only blocks whose contents change get
+ * written to. Returns how many did, or a negative error.
+ */
+int
+limare_recording_uniform_attach(struct limare_state *state,
+				struct limare_recording *recording,
+				int draw, char *name, int size, int count,
+				void *data)
+{
+	struct symbol *symbol = NULL;
+	int fragment = 0, changed, ret, i;
+
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
+	for (i = 0; i < state->vertex_uniform_count; i++)
+		if (!strcmp(state->vertex_uniforms[i]->name, name)) {
+			symbol = state->vertex_uniforms[i];
+			break;
+		}
+
+	if (!symbol)
+		for (i = 0; i < state->fragment_uniform_count; i++)
+			if (!strcmp(state->fragment_uniforms[i]->name, name)) {
+				symbol = state->fragment_uniforms[i];
+				fragment = 1;
+				break;
+			}
+
+	if (!symbol) {
+		printf("%s: Error: Unable to find uniform %s\n",
+		       __func__, name);
+		return -1;
+	}
+
+	if ((symbol->component_size != size) ||
+	    (symbol->component_count != count)) {
+		printf("%s: Error: Uniform %s has wrong dimensions\n",
+		       __func__, name);
+		return -1;
+	}
+
+	changed = record_uniform_patch(state, recording, draw, symbol,
+				       fragment, data, 0);
+	if (changed <= 0)
+		return changed;
+
+	ret = limare_recording_idle(state, recording);
+	if (ret)
+		return ret;
+
+	return record_uniform_patch(state, recording, draw, symbol,
+				    fragment, data, 1);
+}
+
+void
+limare_recording_destroy(struct limare_state *state,
+			 struct limare_recording *recording)
+{
+	if (limare_thread_check(state, __func__))
+		return;
+
+	if (recording->replayed &&
+	    (recording->serial == state->frame_serial)) {
+		printf("%s: Error: recording is used by the current frame.\n",
+		       __func__);
+		return;
+	}
+
+	if (state->recording == recording)
+		state->recording = NULL;
+
+	limare_recording_idle(state, recording);
+
+	record_destroy(state, recording);
 }
@@ -24,6 +24,8 @@
 #ifndef LIMARE_LIMARE_H
 #define LIMARE_LIMARE_H 1
 
+#include <pthread.h>
+
 #define ALIGN(x, y) (((x) + ((y) - 1)) & ~((y) - 1))
 
 static inline unsigned int
@@ -37,47 +39,129 @@ struct lima_cmd {
 	unsigned int cmd;
 };
 
+/*
+ * Running counts of the cpu side work, for benchmarking.
+ */
+struct limare_stats {
+	unsigned long long draws;
+	unsigned long long flushes;
+	unsigned long long allocations; /* host, arena and gpu memory */
+	unsigned long long bytes_copied;
+};
+
 struct limare_state {
+	/* the device, or a simulation of it. */
+	const struct limare_backend *backend;
+	void *backend_private;
 	int fd;
 
+	/* the thread which is allowed to use this state, see below. */
+	pthread_t thread;
+
 #define LIMARE_TYPE_M200 200
 #define LIMARE_TYPE_M400 400
 	int type;
+	int pp_core_count;
 
 	unsigned int mem_physical;
 	unsigned int mem_size;
 	void *mem_address;
 
+	/* memory bank identifier, for growing through big blocks. */
+	unsigned int mem_type_id;
+
+	/* first heap is our MEM_INIT window, the others are big blocks. */
+	struct mem_heap *mem_heap;
+	int mem_total;
+	int mem_used;
+	int mem_used_max; /* high water mark, blocks are kept up to this */
+
+	/* frees waiting for the gpu to be done with a frame. */
+	struct mem_deferred *mem_deferred;
+
 	int width;
 	int height;
 
 	unsigned int clear_color;
 
-	struct lima_gp_job_start *gp_job;
+	/* notification thread and the jobs it is waiting for. */
+	struct limare_jobs *jobs;
 
-	struct draw_info *draws[32];
+	struct draw_info **draws;
 	int draw_count;
+	int draw_size;
 
-	unsigned int draw_mem_offset;
+	/* per frame draw memory, reused once the gpu is done with it. */
+	struct mem_ring *draw_ring;
 	int draw_mem_size;
 
+	/* identical uniform blocks of a frame are shared between draws. */
+	struct uniform_cache *uniform_cache;
+
+	/* software walk of every gp job, see limare_command_stats_enable. */
+	struct decode *decode;
+
+	struct limare_stats stats;
+
+	/* draws currently being recorded into, instead of the frame. */
+	struct limare_recording *recording;
+
+	/* host side draw_info and symbol copies of the current frame. */
+	struct arena *frame_arena;
+
+	unsigned int frame_serial;
+
 	struct plb *plb;
 
 	struct pp_info *pp;
+	int frame_count; /* swap chain length, settable before setup */
+
+	/* overlap the gp of a frame with the pp of the last, set before setup. */
+	int pipeline;
+
+	/* plb and command queues for each frame that can be in flight. */
+#define LIMARE_FRAME_SLOTS 2
+	struct limare_frame_slot {
+		struct plb *plb;
+
+		struct lima_cmd *vs_commands;
+		unsigned int vs_commands_physical;
+		int vs_commands_size;
+
+		struct lima_cmd *plbu_commands;
+		unsigned int plbu_commands_physical;
+		int plbu_commands_size;
+
+		/* the frame last rendered from this slot, until retired. */
+		struct limare_fence *fence;
+		unsigned int serial;
+		int frame_index;
+	} slots[LIMARE_FRAME_SLOTS];
+	int slot_count;
+	int slot;
+	int frame_ready; /* the slot is free, and the commands are started */
+	int frame_error; /* a frame failed, not reported yet */
 
 	struct lima_cmd *vs_commands;
-	int vs_commands_physical;
+	unsigned int vs_commands_physical;
 	int vs_commands_count;
 	int vs_commands_size;
 
 	struct lima_cmd *plbu_commands;
-	int plbu_commands_physical;
+	unsigned int plbu_commands_physical;
 	int plbu_commands_count;
 	int plbu_commands_size;
 
 	/* program */
 	struct lima_shader_binary *vertex_binary;
 
+	/* resident copies of the linked shaders, shared by all draws. */
+	unsigned int program_serial; /* bumped on every link */
+	unsigned int *vertex_shader;
+	unsigned int vertex_shader_physical;
+	unsigned int *fragment_shader;
+	unsigned int fragment_shader_physical;
+
 	struct symbol **vertex_uniforms;
 	int vertex_uniform_count;
 	int vertex_uniform_size;
@@ -99,17 +183,115 @@ struct limare_state {
 	int fragment_varying_count;
 };
 
+struct limare_buffer {
+	void *address;
+	unsigned int physical;
+	int size;
+};
+
+/*
+ * Threading:
+ *
+ * Each state is fully independent: it has its own device fd, memory,
+ * notification thread and locks, so separate states can be driven from
+ * separate threads without ever contending.
+ *
+ * A state itself belongs to one thread at a time: the one which created
+ * it, or the last one to call limare_thread_attach(). All calls taking the
+ * state, apart from those listed below, fail with -EPERM (or NULL) when
+ * made from another thread.
+ *
+ * These can be called from any thread:
+ *  - limare_fence_query/status/wait/callback/release()
+ *  - limare_watchdog_set()
+ *  - limare_buffer_upload()
+ *
+ * Fence callbacks run on the notification thread, unless limare_event_fd()
+ * is in use, in which case they run from limare_dispatch().
+ *
+ * Shader compilation goes through a single process wide lock, as the
+ * compiler library is not known to be reentrant.
+ */
+
+/*
+ * Job priorities, as the kernel takes them: lower is more urgent. Queued
+ * jobs are started in order of priority, but running jobs are never
+ * preempted.
+ */
+#define LIMARE_PRIORITY_HIGH 0
+#define LIMARE_PRIORITY_NORMAL 1
+#define LIMARE_PRIORITY_LOW 2
+
+/* pass as watchdog to use what was set through limare_watchdog_set(). */
+#define LIMARE_WATCHDOG_DEFAULT -1
+
 /* from limare.c */
 struct limare_state *limare_init(void);
+int limare_thread_attach(struct limare_state *state);
+int limare_thread_check(struct limare_state *state, const char *caller);
 int limare_state_setup(struct limare_state *state, int width, int height,
 			unsigned int clear_color);
 int limare_uniform_attach(struct limare_state *state, char *name, int size,
 			   int count, void *data);
 int limare_attribute_pointer(struct limare_state *state, char *name, int size,
 			      int count, void *data);
+struct limare_buffer *limare_buffer_create(struct limare_state *state,
+					   int size);
+int limare_buffer_upload(struct limare_buffer *buffer, int offset,
+			 void *data, int size);
+void limare_buffer_destroy(struct limare_state *state,
+			   struct limare_buffer *buffer);
+int limare_attribute_buffer(struct limare_state *state, char *name, int size,
+			    int count, struct limare_buffer *buffer,
+			    int offset);
+void *limare_attribute_stream(struct limare_state *state, char *name,
+			      int size, int count, int entries);
 int limare_draw_arrays(struct limare_state *state, int mode,
 			int vertex_start, int vertex_count);
+struct limare_fence *limare_flush_async(struct limare_state *state);
+struct limare_fence *limare_flush_submit(struct limare_state *state,
+					 int priority, int watchdog);
 int limare_flush(struct limare_state *state);
-void limare_finish(void);
+int limare_wait(struct limare_state *state);
+void limare_watchdog_set(struct limare_state *state, int msecs);
+int limare_event_fd(struct limare_state *state);
+int limare_dispatch(struct limare_state *state);
+struct limare_fence;
+int limare_fence_query(struct limare_state *state, struct limare_fence *fence);
+int limare_fence_status(struct limare_state *state,
+			struct limare_fence *fence);
+int limare_fence_wait(struct limare_state *state, struct limare_fence *fence,
+		      int timeout);
+void limare_fence_callback(struct limare_state *state,
+			   struct limare_fence *fence,
+			   void (*callback)(struct limare_fence *fence,
+					    unsigned int status, void *data),
+			   void *data);
+void limare_fence_release(struct limare_state *state,
+			  struct limare_fence *fence);
+
+void *limare_frame_last(struct limare_state *state, int *index);
+int limare_frame_next(struct limare_state *state);
+void limare_uniform_stats_print(struct limare_state *state);
+void limare_stats_get(struct limare_state *state, struct limare_stats *stats);
+int limare_command_stats_enable(struct limare_state *state);
+void limare_command_stats_print(struct limare_state *state, int draws);
+int limare_reference_render(struct limare_state *state, void *buffer,
+			    int thread_count);
+int limare_finish(struct limare_state *state);
+void limare_fini(struct limare_state *state);
+
+struct limare_recording;
+struct limare_recording *limare_record_begin(struct limare_state *state,
+					     int size);
+int limare_record_end(struct limare_state *state);
+int limare_replay(struct limare_state *state,
+		  struct limare_recording *recording);
+int limare_recording_uniform_attach(struct limare_state *state,
+				    struct limare_recording *recording,
+				    int draw, char *name, int size, int count,
+				    void *data);
+void limare_recording_destroy(struct limare_state *state,
+			      struct limare_recording *recording);
 
 #endif /* LIMARE_LIMARE_H */
@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sub-allocation of the mali mapped memory.
+ *
+ * Simple first fit over a sorted list of chunks. Everything is at least
+ * MEM_ALIGN_DEFAULT aligned, so that the gp and pp structures can be placed
+ * anywhere, and neighbouring free chunks get merged again on free.
+ *
+ * When all heaps are full, another big block is requested from the kernel.
+ * Blocks which become empty again are only handed back when we hold more
+ * than our high water mark, so steady state frames do not hit the kernel.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define u32 uint32_t
+#include "linux/mali_ioctl.h"
+
+#include "limare.h"
+#include "mem.h"
+#include "backend.h"
+
+static struct mem_chunk *
+mem_chunk_create(int offset, int size, int used, struct mem_chunk *next)
+{
+	struct mem_chunk *chunk = calloc(1, sizeof(struct mem_chunk));
+
+	if (!chunk) {
+		printf("%s: Error: failed to allocate chunk: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	chunk->offset = offset;
+	chunk->size = size;
+	chunk->used = used;
+	chunk->next = next;
+
+	return chunk;
+}
+
+struct mem_heap *
+mem_heap_create(unsigned int physical, void *address, int size)
+{
+	struct mem_heap *heap;
+
+	heap = calloc(1, sizeof(struct mem_heap));
+	if (!heap) {
+		printf("%s: Error: failed to allocate heap: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	heap->physical = physical;
+	heap->address = address;
+	heap->size = size;
+
+	heap->chunks = mem_chunk_create(0, size, 0, NULL);
+	if (!heap->chunks) {
+		free(heap);
+		return NULL;
+	}
+
+	return heap;
+}
+
+void
+mem_heap_destroy(struct mem_heap *heap)
+{
+	struct mem_chunk *chunk, *next;
+
+	for (chunk = heap->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(heap);
+}
+
+/*
+ * Returns the offset into the heap, or -1 when there is no room left.
+ * Alignment is of the physical address, not of the offset.
+ */
+int
+mem_heap_alloc(struct mem_heap *heap, int size, int align)
+{
+	struct mem_chunk *chunk;
+
+	if (size <= 0)
+		return -1;
+
+	if (align < MEM_ALIGN_DEFAULT)
+		align = MEM_ALIGN_DEFAULT;
+
+	size = ALIGN(size, MEM_ALIGN_DEFAULT);
+
+	for (chunk = heap->chunks; chunk; chunk = chunk->next) {
+		int start, end;
+
+		if (chunk->used)
+			continue;
+
+		start = ALIGN(heap->physical + chunk->offset, align) -
+			heap->physical;
+		end = chunk->offset + chunk->size;
+
+		if ((start + size) > end)
+			continue;
+
+		/* split off the padding in front. */
+		if (start > chunk->offset) {
+			struct mem_chunk *pad =
+				mem_chunk_create(start, end - start, 0,
+						 chunk->next);
+			if (!pad)
+				return -1;
+
+			chunk->size = start - chunk->offset;
+			chunk->next = pad;
+			chunk = pad;
+		}
+
+		/* and the remainder at the back. */
+		if ((start + size) < end) {
+			struct mem_chunk *rest =
+				mem_chunk_create(start + size,
+						 end - start - size, 0,
+						 chunk->next);
+			if (!rest)
+				return -1;
+
+			chunk->size = size;
+			chunk->next = rest;
+		}
+
+		chunk->used = 1;
+		heap->used += chunk->size;
+
+		return chunk->offset;
+	}
+
+	return -1;
+}
+
+int
+mem_heap_free(struct mem_heap *heap, int offset)
+{
+	struct mem_chunk *chunk, *prev = NULL, *next;
+
+	for (chunk = heap->chunks; chunk; prev = chunk, chunk = chunk->next)
+		if (chunk->offset == offset)
+			break;
+
+	if (!chunk || !chunk->used) {
+		printf("%s: Error: no allocation at offset 0x%x\n",
+		       __func__, offset);
+		return -1;
+	}
+
+	chunk->used = 0;
+	heap->used -= chunk->size;
+
+	next = chunk->next;
+	if (next && !next->used) {
+		chunk->size += next->size;
+		chunk->next = next->next;
+		free(next);
+	}
+
+	if (prev && !prev->used) {
+		prev->size += chunk->size;
+		prev->next = chunk->next;
+		free(chunk);
+	}
+
+	return 0;
+}
+
+void
+mem_heap_print(struct mem_heap *heap)
+{
+	struct mem_chunk *chunk;
+
+	printf("Heap 0x%08x (0x%x), 0x%x used:\n", heap->physical,
+	       heap->size, heap->used);
+
+	for (chunk = heap->chunks; chunk; chunk = chunk->next)
+		printf("\t0x%08x (0x%x) %s\n", heap->physical + chunk->offset,
+		       chunk->size, chunk->used ? "used" : "free");
+}
+
+struct mem_ring *
+mem_ring_create(unsigned int physical, void *address, int size)
+{
+	struct mem_ring *ring;
+
+	ring = calloc(1, sizeof(struct mem_ring));
+	if (!ring) {
+		printf("%s: Error: failed to allocate ring: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	ring->physical = physical;
+	ring->address = address;
+	ring->size = size;
+
+	return ring;
+}
+
+void
+mem_ring_destroy(struct mem_ring *ring)
+{
+	free(ring);
+}
+
+/*
+ * Returns the offset into the ring, or -1 when the gpu still holds on to
+ * too much of it.
+ */
+int
+mem_ring_alloc(struct mem_ring *ring, int size, int align)
+{
+	int start, end, taken;
+
+	if (size <= 0)
+		return -1;
+
+	if (align < MEM_ALIGN_DEFAULT)
+		align = MEM_ALIGN_DEFAULT;
+
+	size = ALIGN(size, MEM_ALIGN_DEFAULT);
+
+	/* nothing outstanding, so start from the beginning again. */
+	if (!ring->used)
+		ring->head = ring->tail = 0;
+
+	start = ALIGN(ring->physical + ring->head, align) - ring->physical;
+
+	if (!ring->used || (ring->head > ring->tail)) {
+		if ((start + size) > ring->size) {
+			/* wrap around, the tail end is lost until retired. */
+			start = 0;
+			if (size > ring->tail)
+				return -1;
+		}
+	} else if ((start + size) > ring->tail)
+		return -1;
+
+	end = start + size;
+	if (end >= ring->head)
+		taken = end - ring->head;
+	else
+		taken = ring->size - ring->head + end;
+
+	ring->used += taken;
+	ring->frame_used += taken;
+
+	ring->head = end;
+	if (ring->head == ring->size)
+		ring->head = 0;
+
+	return start;
+}
+
+/*
+ * Marks everything allocated since the previous call as belonging to the
+ * frame with the given serial.
+ */
+int
+mem_ring_frame_end(struct mem_ring *ring, unsigned int serial)
+{
+	int index;
+
+	if (ring->frame_count == MEM_RING_FRAMES) {
+		printf("%s: Error: too many frames outstanding.\n", __func__);
+		return -1;
+	}
+
+	index = (ring->frame_first + ring->frame_count) % MEM_RING_FRAMES;
+	ring->frames[index].serial = serial;
+	ring->frames[index].end = ring->head;
+	ring->frames[index].used = ring->frame_used;
+	ring->frame_count++;
+
+	ring->frame_used = 0;
+
+	return 0;
+}
+
+/*
+ * Takes back the last mem_ring_frame_end(), for a frame which did not make
+ * it to the gpu after all. Its memory belongs to the next frame again.
+ */
+void
+mem_ring_frame_undo(struct mem_ring *ring)
+{
+	int index;
+
+	if (!ring->frame_count)
+		return;
+
+	index = (ring->frame_first + ring->frame_count - 1) % MEM_RING_FRAMES;
+	ring->frame_used += ring->frames[index].used;
+	ring->frame_count--;
+}
+
+/*
+ * The gpu is done with all frames up to and including serial.
+ */
+void
+mem_ring_retire(struct mem_ring *ring, unsigned int serial)
+{
+	while (ring->frame_count) {
+		int index = ring->frame_first;
+
+		/* serials wrap, so compare the difference. */
+		if ((int) (serial - ring->frames[index].serial) < 0)
+			break;
+
+		ring->tail = ring->frames[index].end;
+		ring->used -= ring->frames[index].used;
+
+		ring->frame_first = (index + 1) % MEM_RING_FRAMES;
+		ring->frame_count--;
+	}
+}
+
+static struct mem_heap *
+limare_mem_grow(struct limare_state *state, int size)
+{
+	const struct limare_backend *backend = state->backend;
+	struct mem_heap *heap, *last;
+	unsigned int physical, cookie;
+	void *address;
+	int ret;
+
+	ret = backend->big_block_get(state, ALIGN(size, MEM_BLOCK_SIZE),
+				     &physical, &size, &cookie);
+	if (ret)
+		return NULL;
+
+	address = backend->mmap(state, physical, size);
+	if (!address) {
+		backend->big_block_free(state, cookie);
+		return NULL;
+	}
+
+	heap = mem_heap_create(physical, address, size);
+	if (!heap) {
+		backend->munmap(state, address, size);
+		backend->big_block_free(state, cookie);
+		return NULL;
+	}
+
+	heap->big_block = 1;
+	heap->cookie = cookie;
+
+	for (last = state->mem_heap; last->next; last = last->next)
+		;
+	last->next = heap;
+
+	state->mem_total += heap->size;
+
+	return heap;
+}
+
+static void
+limare_mem_release(struct limare_state *state, struct mem_heap *heap)
+{
+	struct mem_heap *prev;
+
+	for (prev = state->mem_heap; prev->next != heap; prev = prev->next)
+		;
+	prev->next = heap->next;
+
+	state->mem_total -= heap->size;
+
+	state->backend->munmap(state, heap->address, heap->size);
+	state->backend->big_block_free(state, heap->cookie);
+
+	mem_heap_destroy(heap);
+}
+
+void *
+limare_mem_alloc(struct limare_state *state, int size, int align,
+		 unsigned int *physical)
+{
+	struct mem_heap *heap;
+	int offset = -1, used;
+
+	for (heap = state->mem_heap; heap; heap = heap->next) {
+		used = heap->used;
+		offset = mem_heap_alloc(heap, size, align);
+		if (offset >= 0)
+			break;
+	}
+
+	if (offset < 0) {
+		heap = limare_mem_grow(state, size + align);
+		if (!heap) {
+			printf("%s: Error: no space for 0x%x bytes "
+			       "(0x%x/0x%x used)\n", __func__, size,
+			       state->mem_used, state->mem_total);
+			return NULL;
+		}
+
+		used = heap->used;
+		offset = mem_heap_alloc(heap, size, align);
+		if (offset < 0)
+			return NULL;
+	}
+
+	state->mem_used += heap->used - used;
+	if (state->mem_used > state->mem_used_max)
+		state->mem_used_max = state->mem_used;
+
+	state->stats.allocations++;
+
+	*physical = heap->physical + offset;
+	return heap->address + offset;
+}
+
+void
+limare_mem_free(struct limare_state *state, unsigned int physical)
+{
+	struct mem_heap *heap;
+	int used;
+
+	for (heap = state->mem_heap; heap; heap = heap->next)
+		if ((physical >= heap->physical) &&
+		    (physical < (heap->physical + heap->size)))
+			break;
+
+	if (!heap) {
+		printf("%s: Error: 0x%08x is not ours.\n", __func__, physical);
+		return;
+	}
+
+	used = heap->used;
+	if (!mem_heap_free(heap, physical - heap->physical))
+		state->mem_used -= used - heap->used;
+}
+
+/*
+ * Finds the host mapping of a range of our gpu memory, for when we need to
+ * read back what we handed to the gpu. NULL when not fully inside a heap.
+ */
+void *
+limare_mem_address(struct limare_state *state, unsigned int physical,
+		   int size)
+{
+	struct mem_heap *heap;
+
+	for (heap = state->mem_heap; heap; heap = heap->next)
+		if ((physical >= heap->physical) &&
+		    ((physical - heap->physical + size) <= heap->size))
+			return heap->address + (physical - heap->physical);
+
+	return NULL;
+}
+
+void
+limare_mem_free_deferred(struct limare_state *state, unsigned int physical,
+			 unsigned int serial)
+{
+	struct mem_deferred *deferred, **last;
+
+	deferred = calloc(1, sizeof(struct mem_deferred));
+	if (!deferred) {
+		/* better to leak it than to free it from under the gpu. */
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return;
+	}
+
+	deferred->physical = physical;
+	deferred->serial = serial;
+
+	/* frames retire in order, so keep the list in order too. */
+	for (last = &state->mem_deferred; *last; last = &(*last)->next)
+		;
+	*last = deferred;
+}
+
+/*
+ * The gpu is done with all frames up to and including serial.
+ */
+void
+limare_mem_retire(struct limare_state *state, unsigned int serial)
+{
+	struct mem_deferred *deferred;
+
+	while (state->mem_deferred) {
+		deferred = state->mem_deferred;
+
+		/* serials wrap, so compare the difference. */
+		if ((int) (serial - deferred->serial) < 0)
+			break;
+
+		limare_mem_free(state, deferred->physical);
+
+		state->mem_deferred = deferred->next;
+		free(deferred);
+	}
+}
+
+/*
+ * Hand empty big blocks back, but never drop below the high water mark.
+ */
+void
+limare_mem_trim(struct limare_state *state)
+{
+	struct mem_heap *heap, *next;
+
+	for (heap = state->mem_heap->next; heap; heap = next) {
+		next = heap->next;
+
+		if (heap->used)
+			continue;
+
+		if ((state->mem_total - heap->size) < state->mem_used_max)
+			continue;
+
+		limare_mem_release(state, heap);
+	}
+}
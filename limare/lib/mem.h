@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sub-allocation of the mali mapped memory.
+ */
+
+#ifndef LIMARE_MEM_H
+#define LIMARE_MEM_H 1
+
+/* alignment classes: gp/pp structures and the plb/frames respectively. */
+#define MEM_ALIGN_DEFAULT 0x40
+#define MEM_ALIGN_PAGE 0x1000
+
+/*
+ * A heap is a single contiguous mapped range. It does not touch the device,
+ * so it can be used and tested with any piece of memory.
+ */
+struct mem_chunk {
+	int offset;
+	int size;
+	int used;
+
+	struct mem_chunk *next;
+};
+
+struct mem_heap {
+	unsigned int physical;
+	void *address;
+	int size;
+
+	int used;
+
+	/* sorted by offset, covers the whole heap. */
+	struct mem_chunk *chunks;
+
+	/* for heaps on top of a big block. */
+	int big_block;
+	unsigned int cookie;
+
+	struct mem_heap *next;
+};
+
+struct mem_heap *mem_heap_create(unsigned int physical, void *address,
+				 int size);
+void mem_heap_destroy(struct mem_heap *heap);
+
+int mem_heap_alloc(struct mem_heap *heap, int size, int align);
+int mem_heap_free(struct mem_heap *heap, int offset);
+
+void mem_heap_print(struct mem_heap *heap);
+
+/*
+ * Ring for memory that only lives for a frame. Allocations are handed out
+ * from the head, and a frame's memory is given back in one go, once the
+ * gpu is known to be done with it.
+ */
+#define MEM_RING_FRAMES 8
+
+struct mem_ring {
+	unsigned int physical;
+	void *address;
+	int size;
+
+	int head;
+	int tail;
+	int used; /* including padding lost when wrapping */
+
+	/* bytes taken by the frame currently being built. */
+	int frame_used;
+
+	/* frames handed to the gpu, oldest first. */
+	struct {
+		unsigned int serial;
+		int end;
+		int used;
+	} frames[MEM_RING_FRAMES];
+	int frame_first;
+	int frame_count;
+};
+
+struct mem_ring *mem_ring_create(unsigned int physical, void *address,
+				 int size);
+void mem_ring_destroy(struct mem_ring *ring);
+
+int mem_ring_alloc(struct mem_ring *ring, int size, int align);
+int mem_ring_frame_end(struct mem_ring *ring, unsigned int serial);
+void mem_ring_frame_undo(struct mem_ring *ring);
+void mem_ring_retire(struct mem_ring *ring, unsigned int serial);
+
+/* big blocks are at least this large. */
+#define MEM_BLOCK_SIZE 0x100000
+
+/*
+ * Allocation from the memory attached to our state. This grows through
+ * big blocks when the existing heaps are full.
+ */
+void *limare_mem_alloc(struct limare_state *state, int size, int align,
+		       unsigned int *physical);
+void limare_mem_free(struct limare_state *state, unsigned int physical);
+void limare_mem_trim(struct limare_state *state);
+void *limare_mem_address(struct limare_state *state, unsigned int physical,
+			 int size);
+
+/*
+ * For memory which draws of frames that are not retired yet might still
+ * point to. It gets freed once the frame with the given serial is.
+ */
+struct mem_deferred {
+	unsigned int physical;
+	unsigned int serial;
+
+	struct mem_deferred *next;
+};
+
+void limare_mem_free_deferred(struct limare_state *state,
+			      unsigned int physical, unsigned int serial);
+void limare_mem_retire(struct limare_state *state, unsigned int serial);
+
+#endif /* LIMARE_MEM_H */
@@ -30,6 +30,7 @@
 
 #include "limare.h"
 #include "plb.h"
+#include "mem.h"
 
 /*
  * Generate the plb address stream for the plbu.
@@ -46,7 +47,9 @@ plb_plbu_stream_create(struct plb *plb)
 }
 
 /*
- * Generate the PLB desciptors for the PP.
+ * Generate the PLB desciptors for the PP. The blocks are split over the
+ * streams in order, so that each pp core gets a band of the screen, and
+ * each stream gets its own terminator.
  */
 static void
 plb_pp_stream_create(struct plb *plb)
@@ -55,11 +58,30 @@ plb_pp_stream_create(struct plb *plb)
 	int offset = 0, index = 0;
 	int step_x = 1 << plb->shift_w;
 	int step_y = 1 << plb->shift_h;
+	int blocks = (plb->width >> plb->shift_w) * (plb->height >> plb->shift_h);
+	int block = 0, stream_index = 0, stream_end;
 	unsigned int address = plb->mem_physical + plb->plb_offset;
 	unsigned int *stream = plb->mem_address + plb->pp_offset;
 
+	plb->pp_streams[0] = plb->pp_offset;
+	stream_end = blocks / plb->pp_stream_count;
+
 	for (y = 0; y < plb->height; y += step_y) {
 		for (x = 0; x < plb->width; x += step_x) {
+			if (block == stream_end) {
+				stream[index + 0] = 0;
+				stream[index + 1] = 0xBC000000;
+
+				/* keep each stream 0x40 aligned, like the first. */
+				index = ALIGN(index + 4, 0x10);
+
+				stream_index++;
+				plb->pp_streams[stream_index] =
+					plb->pp_offset + 4 * index;
+				stream_end = (blocks * (stream_index + 1)) /
+					plb->pp_stream_count;
+			}
+
 			for (j = 0; j < step_y; j++) {
 				for (i = 0; i < step_x; i++) {
 					stream[index + 0] = 0;
@@ -72,6 +94,7 @@ plb_pp_stream_create(struct plb *plb)
 			}
 
 			offset += plb->block_size;
+			block++;
 		}
 	}
 
@@ -80,11 +103,14 @@ plb_pp_stream_create(struct plb *plb)
 }
 
 struct plb *
-plb_create(struct limare_state *state, unsigned int physical, void *address, int offset, int size)
+plb_create(struct limare_state *state)
 {
 	struct plb *plb = calloc(1, sizeof(struct plb));
 	int width, height;
 
+	if (!plb)
+		return NULL;
+
 	width = ALIGN(state->width, 16) >> 4;
 	height = ALIGN(state->height, 16) >> 4;
 
@@ -113,18 +139,27 @@ plb_create(struct limare_state *state, unsigned int physical, void *address, int
 	plb->plbu_size = 4 * plb->width * plb->height;
 	plb->plbu_offset = ALIGN(plb->plb_size, 0x40);
 
-	plb->pp_size = 16 * (plb->width * plb->height + 1);
+	/* never more streams than there are blocks. */
+	plb->pp_stream_count = state->pp_core_count;
+	if (plb->pp_stream_count > PLB_PP_STREAMS_MAX)
+		plb->pp_stream_count = PLB_PP_STREAMS_MAX;
+	if (plb->pp_stream_count > (width * height))
+		plb->pp_stream_count = width * height;
+	if (plb->pp_stream_count < 1)
+		plb->pp_stream_count = 1;
+
+	plb->pp_size = 16 * (plb->width * plb->height + plb->pp_stream_count) +
+		0x40 * (plb->pp_stream_count - 1);
 	plb->pp_offset = ALIGN(plb->plbu_offset + plb->plbu_size, 0x40);
 
-	plb->mem_address = address + offset;
-	plb->mem_physical = physical + offset;
 	/* just align to page size for convenience */
 	plb->mem_size = ALIGN(plb->pp_offset + plb->pp_size, 0x1000);
-
-	if (plb->mem_size > size) {
-		printf("Error: plb size exceeds available space.\n");
+	plb->mem_address = limare_mem_alloc(state, plb->mem_size,
+					    MEM_ALIGN_PAGE, &plb->mem_physical);
+	if (!plb->mem_address) {
+		printf("Error: no space available for the plb.\n");
 		free(plb);
-		plb = NULL;
+		return NULL;
 	}
 
 	plb_plbu_stream_create(plb);
@@ -28,6 +28,9 @@
 #ifndef LIMARE_PLB_H
 #define LIMARE_PLB_H 1
 
+/* Mali-400 MP has up to 4 pp cores. */
+#define PLB_PP_STREAMS_MAX 4
+
 struct plb {
 	int block_size; /* 0x200 */
 
@@ -47,14 +50,17 @@ struct plb {
 
 	/* holds the coordinates and addresses of the primitives for the PP */
 	int pp_offset;
-	int pp_size; /* 16 * (width * height + 1) */
+	int pp_size; /* 16 * (width * height + streams), plus alignment */
+
+	/* one terminated stream per pp core, each covering a band of blocks */
+	int pp_stream_count;
+	int pp_streams[PLB_PP_STREAMS_MAX]; /* offsets */
 
 	void *mem_address;
-	int mem_physical;
+	unsigned int mem_physical;
 	int mem_size;
 };
 
-struct plb *plb_create(struct limare_state *state, unsigned int physical,
-		       void *address, int offset, int size);
+struct plb *plb_create(struct limare_state *state);
 
 #endif /* LIMARE_PLB_H */
@@ -40,17 +40,17 @@
 #include "plb.h"
 #include "pp.h"
 #include "jobs.h"
+#include "mem.h"
+#include "decode.h"
 
 struct pp_info *
-pp_info_create(struct limare_state *state,
-	       void *address, unsigned int physical, int size,
-	       unsigned int frame_physical)
+pp_info_create(struct limare_state *state)
 {
 	struct plb *plb;
 	struct pp_info *info;
 	unsigned int quad[5] =
 		{0x00020425, 0x0000000c, 0x01e007cf, 0xb0000000, 0x000005f5};
-	int offset;
+	int offset, i;
 
 	if (!state->plb) {
 		printf("%s: Error: member plb not assigned yet!\n", __func__);
@@ -68,26 +68,46 @@ pp_info_create(struct limare_state *state,
 	info->pitch = state->width * 4;
 	info->clear_color = state->clear_color;
 
-	info->plb_physical = plb->mem_physical + plb->pp_offset;
 	info->plb_shift_w = plb->shift_w;
 	info->plb_shift_h = plb->shift_h;
 
-	/* first, try to grab the necessary space for our image */
-	info->frame_size = info->pitch * info->height;
-	info->frame_physical = frame_physical;
-	info->frame_address = mmap(NULL, info->frame_size, PROT_READ | PROT_WRITE,
-				   MAP_SHARED, state->fd, info->frame_physical);
-	if (info->frame_address == MAP_FAILED) {
-		printf("Error: failed to mmap offset 0x%x (0x%x): %s\n",
-		       info->frame_physical, info->frame_size, strerror(errno));
+	info->frame_count = state->frame_count;
+	if ((info->frame_count < 1) ||
+	    (info->frame_count > PP_FRAME_COUNT_MAX)) {
+		printf("%s: Error: unsupported frame count %d\n",
+		       __func__, info->frame_count);
 		free(info);
 		return NULL;
 	}
 
+	/* first, try to grab the necessary space for our images */
+	info->frame_size = info->pitch * info->height;
+	for (i = 0; i < info->frame_count; i++) {
+		info->frames[i].address =
+			limare_mem_alloc(state, info->frame_size,
+					 MEM_ALIGN_PAGE,
+					 &info->frames[i].physical);
+		if (!info->frames[i].address) {
+			printf("Error: failed to allocate frame (0x%x)\n",
+			       info->frame_size);
+			goto error;
+		}
+	}
+
+	info->frame_current = 0;
+	info->frame_last = -1;
+
+	/* nothing rendered yet, but hand out something valid. */
+	info->frame_address = info->frames[0].address;
+	info->frame_physical = info->frames[0].physical;
+
 	/* now fill out our other requirements */
-	info->quad_address = address;
-	info->quad_physical = physical;
 	info->quad_size = 5;
+	info->quad_address =
+		limare_mem_alloc(state, ALIGN(4 * info->quad_size, 0x40) + 0x40,
+				 MEM_ALIGN_DEFAULT, &info->quad_physical);
+	if (!info->quad_address)
+		goto error;
 
 	memcpy(info->quad_address, quad, 4 * info->quad_size);
 
@@ -103,10 +123,31 @@ pp_info_create(struct limare_state *state,
 	info->render_address[0x0D] = 0x100;
 
 	return info;
+
+ error:
+	for (i = 0; i < info->frame_count; i++)
+		if (info->frames[i].address)
+			limare_mem_free(state, info->frames[i].physical);
+	free(info);
+	return NULL;
 }
 
-int
-limare_m200_pp_job_start(struct limare_state *state, struct pp_info *info)
+/*
+ * The job rendering to this frame has finished, so it can now be read back
+ * or presented, while later jobs render to the next frames.
+ */
+void
+pp_info_frame_done(struct pp_info *info, int index)
+{
+	info->frame_last = index;
+	info->frame_address = info->frames[info->frame_last].address;
+	info->frame_physical = info->frames[info->frame_last].physical;
+}
+
+static int
+limare_m200_pp_job_start(struct limare_state *state, struct pp_info *info,
+			 struct plb *plb, int stream, int priority, int watchdog,
+			 struct limare_fence *after, struct limare_fence **fence)
 {
 	struct lima_m200_pp_job_start *job;
 	int supersampling = 1;
@@ -118,10 +159,13 @@ limare_m200_pp_job_start(struct limare_state *state, struct pp_info *info)
 		return errno;
 	}
 
+	/* the job, and the fence tracking it. */
+	state->stats.allocations += 2;
+
 	info->job.m200 = job;
 
 	/* frame registers */
-	job->frame.plbu_array_address = info->plb_physical;
+	job->frame.plbu_array_address = plb->mem_physical + plb->pp_streams[stream];
         job->frame.render_address = info->render_physical;
 
 	job->frame.flags = LIMA_PP_FRAME_FLAGS_ACTIVE;
@@ -157,7 +201,7 @@ limare_m200_pp_job_start(struct limare_state *state, struct pp_info *info)
 
 	/* write back registers */
 	job->wb[0].type = LIMA_PP_WB_TYPE_COLOR;
-	job->wb[0].address = info->frame_physical;
+	job->wb[0].address = info->frames[info->frame_current].physical;
 	job->wb[0].pixel_format = LIMA_PIXEL_FORMAT_RGBA_8888;
 	job->wb[0].downsample_factor = 0;
 	job->wb[0].pixel_layout = 0;
@@ -166,12 +210,15 @@ limare_m200_pp_job_start(struct limare_state *state, struct pp_info *info)
 	job->wb[0].mrt_pitch = 0;
 	job->wb[0].zero = 0;
 
-	return limare_m200_pp_job_start_direct(state, job);
+	return limare_m200_pp_job_start_direct(state, job, priority, watchdog,
+					       after, fence);
 }
 
 /* 3 registers were added, and "supersampling" is disabled */
-int
-limare_m400_pp_job_start(struct limare_state *state, struct pp_info *info)
+static int
+limare_m400_pp_job_start(struct limare_state *state, struct pp_info *info,
+			 struct plb *plb, int stream, int priority, int watchdog,
+			 struct limare_fence *after, struct limare_fence **fence)
 {
 	struct lima_m400_pp_job_start *job;
 	int supersampling = 0;
@@ -184,10 +231,13 @@ limare_m400_pp_job_start(struct limare_state *state, struct pp_info *info)
 		return errno;
 	}
 
+	/* the job, and the fence tracking it. */
+	state->stats.allocations += 2;
+
 	info->job.m400 = job;
 
 	/* frame registers */
-	job->frame.plbu_array_address = info->plb_physical;
+	job->frame.plbu_array_address = plb->mem_physical + plb->pp_streams[stream];
         job->frame.render_address = info->render_physical;
 
 	job->frame.flags = LIMA_PP_FRAME_FLAGS_ACTIVE;
@@ -243,7 +293,7 @@ limare_m400_pp_job_start(struct limare_state *state, struct pp_info *info)
 
 	/* write back registers */
 	job->wb[0].type = LIMA_PP_WB_TYPE_COLOR;
-	job->wb[0].address = info->frame_physical;
+	job->wb[0].address = info->frames[info->frame_current].physical;
 	job->wb[0].pixel_format = LIMA_PIXEL_FORMAT_RGBA_8888;
 	job->wb[0].downsample_factor = 0;
 	job->wb[0].pixel_layout = 0;
@@ -253,14 +303,68 @@ limare_m400_pp_job_start(struct limare_state *state, struct pp_info *info)
 	job->wb[0].mrt_pitch = 0;
 	job->wb[0].zero = 0;
 
-	return limare_m400_pp_job_start_direct(state, job);
+	return limare_m400_pp_job_start_direct(state, job, priority, watchdog,
+					       after, fence);
 }
 
 int
-limare_pp_job_start(struct limare_state *state, struct pp_info *info)
+limare_pp_job_start(struct limare_state *state, struct pp_info *info,
+		    struct plb *plb, int priority, int watchdog,
+		    struct limare_fence *after, struct limare_fence **fence)
 {
-	if (state->type == 400)
-		return limare_m400_pp_job_start(state, info);
-	else
-		return limare_m200_pp_job_start(state, info);
+	struct limare_fence *fences[PLB_PP_STREAMS_MAX];
+	int ret = 0, i, j;
+
+	/* one job per pp core, each rendering its own part of the frame. */
+	for (i = 0; i < plb->pp_stream_count; i++) {
+		if (state->decode)
+			decode_pp_stream(state->decode, plb->mem_physical +
+					 plb->pp_streams[i]);
+
+		if (state->type == LIMARE_TYPE_M400)
+			ret = limare_m400_pp_job_start(state, info, plb, i,
+						       priority, watchdog,
+						       after, &fences[i]);
+		else
+			ret = limare_m200_pp_job_start(state, info, plb, i,
+						       priority, watchdog,
+						       after, &fences[i]);
+		if (ret)
+			break;
+	}
+
+	if (!ret && fence) {
+		if (i == 1) {
+			*fence = fences[0];
+			fences[0] = NULL;
+		} else {
+			*fence = limare_fence_merge(state, fences, i);
+			if (!*fence)
+				ret = -ENOMEM;
+			else
+				state->stats.allocations++;
+		}
+	}
+
+	/*
+	 * The cores that did get started are still reading the plb and draw
+	 * memory, which the caller is free to reuse once we return an error.
+	 */
+	if (ret)
+		for (j = 0; j < i; j++)
+			if (fences[j])
+				limare_fence_wait(state, fences[j], -1);
+
+	while (i--)
+		if (fences[i])
+			limare_fence_release(state, fences[i]);
+
+	if (ret)
+		return ret;
+
+	/* the next job can already render to the next frame. */
+	info->frame_pending = info->frame_current;
+	info->frame_current = (info->frame_current + 1) % info->frame_count;
+
+	return 0;
 }
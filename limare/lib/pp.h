@@ -39,7 +39,6 @@ struct pp_info
 	int height;
 	int pitch;
 
-	unsigned int plb_physical;
 	int plb_shift_w;
 	int plb_shift_h;
 
@@ -53,15 +52,29 @@ struct pp_info
 	unsigned int render_physical;
 	int render_size;
 
-	/* final render, separately mapped */
+	/* swap chain, frame_current is what the next job renders to. */
+#define PP_FRAME_COUNT_MAX 3
+	struct {
+		void *address;
+		unsigned int physical;
+	} frames[PP_FRAME_COUNT_MAX];
+	int frame_count;
+	int frame_current;
+	int frame_pending; /* what the last submitted job renders to */
+	int frame_last; /* -1 before the first frame has been rendered */
+
+	/* final render, the last frame that was rendered. */
 	void *frame_address;
 	unsigned int frame_physical;
 	int frame_size;
 };
 
-struct pp_info *pp_info_create(struct limare_state *state, void *address,
-			       unsigned int physical, int size,
-			       unsigned int frame_physical);
-int limare_pp_job_start(struct limare_state *state, struct pp_info *info);
+struct plb;
+
+struct pp_info *pp_info_create(struct limare_state *state);
+int limare_pp_job_start(struct limare_state *state, struct pp_info *info,
+			struct plb *plb, int priority, int watchdog,
+			struct limare_fence *after, struct limare_fence **fence);
+void pp_info_frame_done(struct pp_info *info, int index);
 
 #endif /* LIMARE_PP_H */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "limare.h"
 #include "plb.h"
@@ -36,6 +37,7 @@
 #include "program.h"
 #include "compiler.h"
 #include "symbols.h"
+#include "mem.h"
 
 /*
  * Attribute linking:
@@ -952,6 +954,12 @@ limare_shader_binary_free(struct lima_shader_binary *binary)
 	free(binary);
 }
 
+/*
+ * The compiler comes from the binary driver, and is not known to be
+ * reentrant, so all states share this lock.
+ */
+static pthread_mutex_t limare_compiler_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 struct lima_shader_binary *
 limare_shader_compile(int type, const char *source)
 {
@@ -966,8 +974,10 @@ limare_shader_compile(int type, const char *source)
 		return NULL;
 	}
 
+	pthread_mutex_lock(&limare_compiler_mutex);
 	ret = __mali_compile_essl_shader(binary, type,
 					 source, &length, 1);
+	pthread_mutex_unlock(&limare_compiler_mutex);
 	if (ret) {
 		if (binary->error_log)
 			printf("%s: compilation failed: %s\n",
@@ -991,6 +1001,9 @@ vertex_shader_attach(struct limare_state *state, const char *source)
 	struct stream_attribute_table *attribute_table;
 	struct stream_varying_table *varying_table;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	binary = limare_shader_compile(LIMA_SHADER_VERTEX, source);
 	if (!binary)
 		return -1;
@@ -1040,6 +1053,9 @@ fragment_shader_attach(struct limare_state *state, const char *source)
 	struct stream_uniform_table *uniform_table;
 	struct stream_varying_table *varying_table;
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	binary = limare_shader_compile(LIMA_SHADER_FRAGMENT, source);
 	if (!binary)
 		return -1;
@@ -1223,12 +1239,75 @@ vertex_shader_varyings_reorder(struct limare_state *state, int *varyings)
 	       state->vertex_varying_count * sizeof(struct symbol *));
 }
 
+static unsigned int *
+limare_shader_upload(struct limare_state *state, unsigned int *shader,
+		     int size, unsigned int *physical)
+{
+	unsigned int *address;
+
+	address = limare_mem_alloc(state, size, MEM_ALIGN_DEFAULT, physical);
+	if (!address) {
+		printf("%s: Error: no gpu memory for shader\n", __func__);
+		return NULL;
+	}
+
+	memcpy(address, shader, size);
+
+	return address;
+}
+
+/*
+ * Put the linked shaders in gpu memory, once, for all draws to use.
+ *
+ * Draws of the current frame, and of frames still in flight, keep pointing
+ * at the previous copies, so those only get freed once the current frame
+ * is retired.
+ */
+static int
+limare_link_shaders_upload(struct limare_state *state)
+{
+	if (state->vertex_shader) {
+		limare_mem_free_deferred(state, state->vertex_shader_physical,
+					 state->frame_serial);
+		state->vertex_shader = NULL;
+	}
+
+	if (state->fragment_shader) {
+		limare_mem_free_deferred(state,
+					 state->fragment_shader_physical,
+					 state->frame_serial);
+		state->fragment_shader = NULL;
+	}
+
+	/* recordings of the previous link can no longer be replayed. */
+	state->program_serial++;
+
+	state->vertex_shader =
+		limare_shader_upload(state, state->vertex_binary->shader,
+				     state->vertex_binary->shader_size,
+				     &state->vertex_shader_physical);
+	if (!state->vertex_shader)
+		return -1;
+
+	state->fragment_shader =
+		limare_shader_upload(state, state->fragment_binary->shader,
+				     state->fragment_binary->shader_size,
+				     &state->fragment_shader_physical);
+	if (!state->fragment_shader)
+		return -1;
+
+	return 0;
+}
+
 int
 limare_link(struct limare_state *state)
 {
 	int varyings[16] = { -1, -1, -1, -1, -1, -1, -1, -1,
 			     -1, -1, -1, -1, -1, -1, -1, -1 };
 
+	if (limare_thread_check(state, __func__))
+		return -EPERM;
+
 	if (limare_link_varyings_match(state))
 		return -1;
 
@@ -1238,5 +1317,8 @@ limare_link(struct limare_state *state)
 				     varyings);
 	vertex_shader_varyings_reorder(state, varyings);
 
+	if (limare_link_shaders_upload(state))
+		return -1;
+
 	return 0;
 }
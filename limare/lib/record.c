@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Recording of draws, so that static content does not need to go through
+ * limare_draw_arrays every frame.
+ *
+ * While recording, the draw ring of the state is swapped for memory of the
+ * recording itself, so draws, their attribute copies, varyings, render
+ * states and uniform blocks all end up there, and stay valid. The command
+ * words emitted for the draws are then taken out of the frame again, and
+ * get appended to the command queues of each frame which replays them. The
+ * gp has no known way to jump to another command stream, so these words
+ * are copied, but that is all that happens per draw.
+ *
+ * Recorded uniform blocks are never shared, so that each can be patched.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "limare.h"
+#include "symbols.h"
+#include "gp.h"
+#include "mem.h"
+#include "uniforms.h"
+#include "record.h"
+
+struct limare_recording *
+record_create(struct limare_state *state, int size)
+{
+	struct limare_recording *recording;
+	unsigned int physical;
+	void *address;
+
+	recording = calloc(1, sizeof(struct limare_recording));
+	if (!recording) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	address = limare_mem_alloc(state, size, MEM_ALIGN_PAGE, &physical);
+	if (!address) {
+		free(recording);
+		return NULL;
+	}
+
+	recording->ring = mem_ring_create(physical, address, size);
+	if (!recording->ring) {
+		limare_mem_free(state, physical);
+		free(recording);
+		return NULL;
+	}
+
+	recording->vertex_binary = state->vertex_binary;
+	recording->fragment_binary = state->fragment_binary;
+	recording->program_serial = state->program_serial;
+
+	recording->vertex_uniform_size = 4 * state->vertex_uniform_size;
+	recording->fragment_uniform_size = 4 * state->fragment_uniform_size;
+
+	recording->vs_start = state->vs_commands_count;
+	recording->plbu_start = state->plbu_commands_count;
+
+	recording->frame_ring = state->draw_ring;
+	state->draw_ring = recording->ring;
+
+	return recording;
+}
+
+void
+record_destroy(struct limare_state *state, struct limare_recording *recording)
+{
+	record_abort(state, recording);
+
+	limare_mem_free(state, recording->ring->physical);
+	mem_ring_destroy(recording->ring);
+
+	free(recording->vs_commands);
+	free(recording->plbu_commands);
+	free(recording->draws);
+	free(recording);
+}
+
+/*
+ * Host address of memory of this recording, NULL when it is not ours.
+ */
+void *
+record_address(struct limare_recording *recording, unsigned int physical)
+{
+	struct mem_ring *ring = recording->ring;
+
+	if ((physical < ring->physical) ||
+	    (physical >= (ring->physical + ring->size)))
+		return NULL;
+
+	return ring->address + (physical - ring->physical);
+}
+
+int
+record_draw_add(struct limare_state *state,
+		struct limare_recording *recording, struct draw_info *draw)
+{
+	struct record_draw *record;
+
+	if (recording->draw_count == recording->draw_size) {
+		struct record_draw *draws;
+		int size = recording->draw_size ?
+			(2 * recording->draw_size) : 16;
+
+		draws = realloc(recording->draws,
+				size * sizeof(struct record_draw));
+		if (!draws) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			return -1;
+		}
+
+		recording->draws = draws;
+		recording->draw_size = size;
+	}
+
+	record = &recording->draws[recording->draw_count];
+	recording->draw_count++;
+
+	record->vertex_uniforms =
+		record_address(recording, draw->vs->uniform_physical);
+
+	/* skip the single entry array in front. */
+	record->fragment_uniforms = NULL;
+	if (draw->plbu->uniform_size)
+		record->fragment_uniforms =
+			record_address(recording,
+				       draw->plbu->uniform_array_physical +
+				       0x40);
+
+	return 0;
+}
+
+/*
+ * Takes the command words of the recorded draws back out of the frame,
+ * and hands back the draw ring.
+ */
+void
+record_abort(struct limare_state *state, struct limare_recording *recording)
+{
+	if (!recording->frame_ring)
+		return;
+
+	state->vs_commands_count = recording->vs_start;
+	state->plbu_commands_count = recording->plbu_start;
+
+	state->draw_ring = recording->frame_ring;
+	recording->frame_ring = NULL;
+}
+
+/*
+ * Keeps a copy of the command words, before they get taken out.
+ */
+int
+record_finish(struct limare_state *state, struct limare_recording *recording)
+{
+	int ret = 0;
+
+	recording->vs_count = state->vs_commands_count - recording->vs_start;
+	recording->plbu_count =
+		state->plbu_commands_count - recording->plbu_start;
+
+	recording->vs_commands = malloc(8 * recording->vs_count + 8);
+	recording->plbu_commands = malloc(8 * recording->plbu_count + 8);
+	if (!recording->vs_commands || !recording->plbu_commands) {
+		printf("%s: Error: failed to allocate: %s\n", __func__,
+		       strerror(errno));
+		recording->vs_count = 0;
+		recording->plbu_count = 0;
+		ret = -1;
+	} else {
+		memcpy(recording->vs_commands,
+		       &state->vs_commands[recording->vs_start],
+		       8 * recording->vs_count);
+		memcpy(recording->plbu_commands,
+		       &state->plbu_commands[recording->plbu_start],
+		       8 * recording->plbu_count);
+	}
+
+	record_abort(state, recording);
+
+	return ret;
+}
+
+/*
+ * Compares the new value of a uniform against the given draw, or all draws
+ * when draw is -1, and with write set, updates the ones that differ.
+ * Returns the number of blocks that differ(ed).
+ */
+int
+record_uniform_patch(struct limare_state *state,
+		     struct limare_recording *recording, int draw,
+		     struct symbol *symbol, int fragment, void *data,
+		     int write)
+{
+	struct symbol patch = *symbol;
+	void *scratch;
+	int size, offset, length, first, last, changed = 0, i;
+
+	if (draw >= recording->draw_count) {
+		printf("%s: Error: recording only has %d draws\n", __func__,
+		       recording->draw_count);
+		return -1;
+	}
+
+	if (draw < 0) {
+		first = 0;
+		last = recording->draw_count;
+	} else {
+		first = draw;
+		last = draw + 1;
+	}
+
+	if (fragment)
+		size = recording->fragment_uniform_size;
+	else
+		size = recording->vertex_uniform_size;
+
+	scratch = uniform_cache_scratch(state->uniform_cache, size);
+	if (!scratch)
+		return -1;
+
+	patch.data = data;
+	offset = symbol->component_size * symbol->offset;
+	if (fragment)
+		length = plbu_uniform_pack(scratch, &patch);
+	else
+		length = vs_uniform_pack(scratch, &patch);
+
+	if ((offset + length) > size) {
+		printf("%s: Error: %s does not fit its block\n", __func__,
+		       symbol->name);
+		return -1;
+	}
+
+	for (i = first; i < last; i++) {
+		void *block;
+
+		if (fragment)
+			block = recording->draws[i].fragment_uniforms;
+		else
+			block = recording->draws[i].vertex_uniforms;
+
+		if (!block)
+			continue;
+
+		if (!memcmp(block + offset, scratch + offset, length))
+			continue;
+
+		changed++;
+
+		if (write) {
+			memcpy(block + offset, scratch + offset, length);
+			state->stats.bytes_copied += length;
+		}
+	}
+
+	return changed;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Recorded draws, replayed every frame without being rebuilt.
+ */
+
+#ifndef LIMARE_RECORD_H
+#define LIMARE_RECORD_H 1
+
+struct record_draw {
+	/* this draws uniform blocks, which get patched in place. */
+	void *vertex_uniforms;
+	void *fragment_uniforms;
+};
+
+struct limare_recording {
+	/* all draw memory, taken instead of the draw ring while recording. */
+	struct mem_ring *ring;
+	struct mem_ring *frame_ring;
+
+	/* the program that the commands point to. */
+	struct lima_shader_binary *vertex_binary;
+	struct lima_shader_binary *fragment_binary;
+	unsigned int program_serial; /* the link, as shaders move on relink */
+
+	int vertex_uniform_size; /* bytes */
+	int fragment_uniform_size;
+
+	/* where recording started in the command queues of the frame. */
+	int vs_start;
+	int plbu_start;
+
+	struct lima_cmd *vs_commands;
+	int vs_count;
+	struct lima_cmd *plbu_commands;
+	int plbu_count;
+
+	struct record_draw *draws;
+	int draw_count;
+	int draw_size;
+
+	/* the frame this was last replayed in. */
+	unsigned int serial;
+	int replayed;
+
+	/* the last frame before that, which has been handed to the gpu. */
+	unsigned int serial_submitted;
+	int submitted;
+};
+
+struct limare_recording *record_create(struct limare_state *state, int size);
+void record_destroy(struct limare_state *state,
+		    struct limare_recording *recording);
+
+void *record_address(struct limare_recording *recording,
+		     unsigned int physical);
+
+int record_draw_add(struct limare_state *state,
+		    struct limare_recording *recording,
+		    struct draw_info *draw);
+void record_abort(struct limare_state *state,
+		  struct limare_recording *recording);
+int record_finish(struct limare_state *state,
+		  struct limare_recording *recording);
+
+int record_uniform_patch(struct limare_state *state,
+			 struct limare_recording *recording, int draw,
+			 struct symbol *symbol, int fragment, void *data,
+			 int write);
+
+#endif /* LIMARE_RECORD_H */
@@ -0,0 +1,832 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Renders the last frame which went through the decoder on the cpu, from
+ * the gp outputs of that frame, so that there is something to compare the
+ * pp against.
+ *
+ * The gp has to have run, as the vertex shader outputs are read back from
+ * the varying buffers: gl_Position is the last varying, already in window
+ * coordinates with 1/w in its last component, and the others are 4 half
+ * floats each. So this needs the real hardware, the simulated backend does
+ * not run shaders. The fragment shader is not run either, the colour is the
+ * first varying, or the first fragment uniform when there are no varyings.
+ * This matches all the fragment shaders of our tests.
+ *
+ * The rest follows the descriptors of the frame: the plbu setup gives the
+ * plb block layout, and the plbu array gives the address of each block.
+ * The primitives which the gp writes into the blocks are not documented
+ * well enough to be read back, so triangles get binned into the blocks here
+ * again, in draw order. The pp streams are then walked like the pp cores
+ * do: each tile gets cleared, and the triangles of the block which the
+ * stream points it at get rasterized, with 4 samples per pixel like the 4x
+ * msaa which our render state enables. Tiles that the streams miss, or list
+ * twice, are reported. There is no depth test, culling or blending, as none
+ * of these are set up by us either.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "limare.h"
+#include "symbols.h"
+#include "gp.h"
+#include "render_state.h"
+#include "hfloat.h"
+#include "mem.h"
+#include "plb.h"
+#include "decode.h"
+#include "reference.h"
+
+/* gl draw modes, as they end up in the plbu draw command. */
+#define REFERENCE_MODE_TRIANGLES 0x04
+#define REFERENCE_MODE_TRIANGLE_STRIP 0x05
+#define REFERENCE_MODE_TRIANGLE_FAN 0x06
+
+#define REFERENCE_THREADS_MAX 16
+
+struct reference_vertex {
+	float x;
+	float y;
+	float w_inv;
+	float color[4];
+};
+
+struct reference_triangle {
+	struct reference_vertex vertices[3];
+	float area;
+
+	int x0, y0, x1, y1; /* inclusive pixel bounds */
+};
+
+/* a tile as a pp stream lists it. */
+struct reference_tile {
+	int x; /* in tiles */
+	int y;
+	int block; /* whose triangles get rendered into it */
+};
+
+struct reference {
+	struct limare_state *state;
+	struct decode_plb *plb;
+	unsigned int *buffer;
+
+	struct reference_triangle *triangles;
+	int triangle_count;
+	int triangle_size;
+
+	/* plb blocks, from the plbu array. */
+	int blocks_w;
+	int blocks_h;
+	unsigned int *block_physical; /* blocks_w * blocks_h */
+
+	/* triangle indices per block, in draw order. */
+	int *block_start; /* blocks_w * blocks_h + 1 */
+	int *block_triangles;
+
+	/* all pp streams, one after the other. */
+	struct reference_tile *tiles;
+	int tile_count;
+
+	pthread_mutex_t mutex;
+	int tile_next;
+};
+
+/*
+ * Pixels are stored the way the pp writes them out.
+ */
+static void
+reference_pixel_unpack(struct limare_state *state, unsigned int pixel,
+		       float *color)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		color[i] = ((pixel >> (8 * i)) & 0xFF) / 255.0;
+
+	if (state->type == LIMARE_TYPE_M200) {
+		float red = color[2];
+
+		color[2] = color[0];
+		color[0] = red;
+	}
+}
+
+static unsigned int
+reference_pixel_pack(struct limare_state *state, float *color)
+{
+	unsigned int pixel = 0, channel;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		float value = color[i];
+
+		if (!(value > 0.0))
+			value = 0.0;
+		else if (value > 1.0)
+			value = 1.0;
+
+		channel = value * 255.0 + 0.5;
+
+		if ((state->type == LIMARE_TYPE_M200) && (i != 1) && (i != 3))
+			pixel |= channel << (8 * (2 - i));
+		else
+			pixel |= channel << (8 * i);
+	}
+
+	return pixel;
+}
+
+static struct reference_triangle *
+reference_triangle_new(struct reference *reference)
+{
+	if (reference->triangle_count == reference->triangle_size) {
+		struct reference_triangle *triangles;
+		int size = reference->triangle_size ?
+			2 * reference->triangle_size : 256;
+
+		triangles = realloc(reference->triangles,
+				    size * sizeof(struct reference_triangle));
+		if (!triangles) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			return NULL;
+		}
+
+		reference->triangles = triangles;
+		reference->triangle_size = size;
+	}
+
+	return &reference->triangles[reference->triangle_count++];
+}
+
+static int
+reference_triangle_add(struct reference *reference,
+		       struct reference_vertex *a, struct reference_vertex *b,
+		       struct reference_vertex *c)
+{
+	struct limare_state *state = reference->state;
+	struct reference_triangle *triangle;
+	float x0, y0, x1, y1;
+	float area;
+
+	area = (b->x - a->x) * (c->y - a->y) - (c->x - a->x) * (b->y - a->y);
+	if (!(area != 0.0)) /* also drops nan */
+		return 0;
+
+	x0 = fminf(a->x, fminf(b->x, c->x));
+	x1 = fmaxf(a->x, fmaxf(b->x, c->x));
+	y0 = fminf(a->y, fminf(b->y, c->y));
+	y1 = fmaxf(a->y, fmaxf(b->y, c->y));
+
+	if ((x1 < 0.0) || (y1 < 0.0) ||
+	    (x0 >= state->width) || (y0 >= state->height))
+		return 0;
+
+	triangle = reference_triangle_new(reference);
+	if (!triangle)
+		return -1;
+
+	triangle->vertices[0] = *a;
+	triangle->vertices[1] = *b;
+	triangle->vertices[2] = *c;
+	triangle->area = area;
+
+	triangle->x0 = (x0 < 0.0) ? 0 : x0;
+	triangle->y0 = (y0 < 0.0) ? 0 : y0;
+	triangle->x1 = (x1 >= state->width) ? (state->width - 1) : x1;
+	triangle->y1 = (y1 >= state->height) ? (state->height - 1) : y1;
+
+	return 0;
+}
+
+/*
+ * Reads back what the gp wrote for this draw, and turns it into triangles.
+ */
+static int
+reference_draw_add(struct reference *reference, struct decode_draw *draw)
+{
+	struct limare_state *state = reference->state;
+	struct gp_common_entry *entries, *position_entry;
+	struct reference_vertex *vertices;
+	float *position, flat[4] = { 0.0, 0.0, 0.0, 1.0 };
+	hfloat *color = NULL;
+	int i, ret = 0;
+
+	if ((draw->draw_mode != REFERENCE_MODE_TRIANGLES) &&
+	    (draw->draw_mode != REFERENCE_MODE_TRIANGLE_STRIP) &&
+	    (draw->draw_mode != REFERENCE_MODE_TRIANGLE_FAN)) {
+		printf("%s: Error: draw mode 0x%02x is not supported\n",
+		       __func__, draw->draw_mode);
+		return -1;
+	}
+
+	if ((draw->vertex_count < 3) || (draw->varying_count < 1))
+		return 0;
+
+	entries = limare_mem_address(state, draw->varyings_physical,
+				     draw->varying_count *
+				     sizeof(struct gp_common_entry));
+	if (!entries) {
+		printf("%s: Error: varyings table is not ours\n", __func__);
+		return -1;
+	}
+
+	position_entry = &entries[draw->varying_count - 1];
+	position = limare_mem_address(state, position_entry->physical,
+				      16 * draw->vertex_count);
+	if (!position) {
+		printf("%s: Error: gl_Position is not ours\n", __func__);
+		return -1;
+	}
+
+	if (draw->varying_count > 1) {
+		color = limare_mem_address(state, entries[0].physical,
+					   8 * draw->vertex_count);
+		if (!color) {
+			printf("%s: Error: varying 0 is not ours\n", __func__);
+			return -1;
+		}
+	} else {
+		struct render_state *render_state;
+		unsigned int *array;
+		hfloat *uniform;
+
+		render_state =
+			limare_mem_address(state, draw->render_state_physical,
+					   sizeof(struct render_state));
+		if (render_state && (render_state->unknown34 & 0x80)) {
+			array = limare_mem_address(state,
+				render_state->uniforms_address & ~0x3F, 4);
+			uniform = array ?
+				limare_mem_address(state, *array, 8) : NULL;
+			if (uniform)
+				for (i = 0; i < 4; i++)
+					flat[i] = hfloat_to_float(uniform[i]);
+		}
+	}
+
+	vertices = calloc(draw->vertex_count, sizeof(struct reference_vertex));
+	if (!vertices) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < draw->vertex_count; i++) {
+		struct reference_vertex *vertex = &vertices[i];
+		int j;
+
+		vertex->x = position[4 * i];
+		vertex->y = position[4 * i + 1];
+		vertex->w_inv = position[4 * i + 3];
+		if (!(vertex->w_inv > 0.0) || isinf(vertex->w_inv))
+			vertex->w_inv = 1.0;
+
+		for (j = 0; j < 4; j++)
+			if (color)
+				vertex->color[j] =
+					hfloat_to_float(color[4 * i + j]);
+			else
+				vertex->color[j] = flat[j];
+	}
+
+	if (draw->draw_mode == REFERENCE_MODE_TRIANGLES) {
+		for (i = 0; (i + 2) < draw->vertex_count; i += 3) {
+			ret = reference_triangle_add(reference, &vertices[i],
+						     &vertices[i + 1],
+						     &vertices[i + 2]);
+			if (ret)
+				break;
+		}
+	} else if (draw->draw_mode == REFERENCE_MODE_TRIANGLE_STRIP) {
+		for (i = 0; (i + 2) < draw->vertex_count; i++) {
+			/* keep the winding the same. */
+			if (i & 1)
+				ret = reference_triangle_add(reference,
+							     &vertices[i + 1],
+							     &vertices[i],
+							     &vertices[i + 2]);
+			else
+				ret = reference_triangle_add(reference,
+							     &vertices[i],
+							     &vertices[i + 1],
+							     &vertices[i + 2]);
+			if (ret)
+				break;
+		}
+	} else {
+		for (i = 1; (i + 1) < draw->vertex_count; i++) {
+			ret = reference_triangle_add(reference, &vertices[0],
+						     &vertices[i],
+						     &vertices[i + 1]);
+			if (ret)
+				break;
+		}
+	}
+
+	free(vertices);
+
+	return ret;
+}
+
+/*
+ * Takes the block layout from the plbu setup, and the block addresses from
+ * the plbu array which it points to.
+ */
+static int
+reference_blocks_get(struct reference *reference)
+{
+	struct limare_state *state = reference->state;
+	struct decode_plb *plb = reference->plb;
+	unsigned int *array;
+	int x, y;
+
+	if (!plb->tiles_w || !plb->tiles_h || !plb->block_stride ||
+	    !plb->array_physical) {
+		printf("%s: Error: plbu setup is incomplete\n", __func__);
+		return -1;
+	}
+
+	reference->blocks_w = ALIGN(plb->tiles_w, 1 << plb->shift_w) >>
+		plb->shift_w;
+	reference->blocks_h = ALIGN(plb->tiles_h, 1 << plb->shift_h) >>
+		plb->shift_h;
+
+	if (reference->blocks_w > plb->block_stride) {
+		printf("%s: Error: %d blocks in a row of %d\n", __func__,
+		       reference->blocks_w, plb->block_stride);
+		return -1;
+	}
+
+	array = limare_mem_address(state, plb->array_physical,
+				   4 * plb->block_stride * reference->blocks_h);
+	if (!array) {
+		printf("%s: Error: plbu array is not ours\n", __func__);
+		return -1;
+	}
+
+	reference->block_physical =
+		calloc(reference->blocks_w * reference->blocks_h,
+		       sizeof(unsigned int));
+	if (!reference->block_physical) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return -1;
+	}
+
+	for (y = 0; y < reference->blocks_h; y++)
+		for (x = 0; x < reference->blocks_w; x++)
+			reference->block_physical[y * reference->blocks_w + x] =
+				array[y * plb->block_stride + x];
+
+	return 0;
+}
+
+static void
+reference_triangle_blocks(struct reference *reference,
+			  struct reference_triangle *triangle,
+			  int *x0, int *y0, int *x1, int *y1)
+{
+	struct decode_plb *plb = reference->plb;
+
+	*x0 = (triangle->x0 / REFERENCE_TILE_SIZE) >> plb->shift_w;
+	*y0 = (triangle->y0 / REFERENCE_TILE_SIZE) >> plb->shift_h;
+	*x1 = (triangle->x1 / REFERENCE_TILE_SIZE) >> plb->shift_w;
+	*y1 = (triangle->y1 / REFERENCE_TILE_SIZE) >> plb->shift_h;
+
+	if (*x1 >= reference->blocks_w)
+		*x1 = reference->blocks_w - 1;
+	if (*y1 >= reference->blocks_h)
+		*y1 = reference->blocks_h - 1;
+}
+
+/*
+ * Like the plbu, a triangle goes into every block its bounds touch. Counting
+ * first, then filling in, so the lists end up in one array.
+ */
+static int
+reference_bin(struct reference *reference)
+{
+	int block_count = reference->blocks_w * reference->blocks_h;
+	int *fill, i, x, y, x0, y0, x1, y1;
+
+	reference->block_start = calloc(block_count + 1, sizeof(int));
+	fill = calloc(block_count, sizeof(int));
+	if (!reference->block_start || !fill) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		free(fill);
+		return -1;
+	}
+
+	for (i = 0; i < reference->triangle_count; i++) {
+		reference_triangle_blocks(reference, &reference->triangles[i],
+					  &x0, &y0, &x1, &y1);
+
+		for (y = y0; y <= y1; y++)
+			for (x = x0; x <= x1; x++)
+				reference->block_start[y * reference->blocks_w +
+						       x + 1]++;
+	}
+
+	for (i = 0; i < block_count; i++)
+		reference->block_start[i + 1] += reference->block_start[i];
+
+	reference->block_triangles =
+		calloc(reference->block_start[block_count] + 1, sizeof(int));
+	if (!reference->block_triangles) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		free(fill);
+		return -1;
+	}
+
+	for (i = 0; i < reference->triangle_count; i++) {
+		reference_triangle_blocks(reference, &reference->triangles[i],
+					  &x0, &y0, &x1, &y1);
+
+		for (y = y0; y <= y1; y++)
+			for (x = x0; x <= x1; x++) {
+				int block = y * reference->blocks_w + x;
+
+				reference->block_triangles
+					[reference->block_start[block] +
+					 fill[block]++] = i;
+			}
+	}
+
+	free(fill);
+
+	return 0;
+}
+
+static int
+reference_block_find(struct reference *reference, unsigned int physical)
+{
+	int i;
+
+	for (i = 0; i < (reference->blocks_w * reference->blocks_h); i++)
+		if (reference->block_physical[i] == physical)
+			return i;
+
+	return -1;
+}
+
+/*
+ * A pp stream is a list of tiles, each a position followed by the address
+ * of the plb block to render, and ends with 0xBC000000. This is what
+ * plb_pp_stream_create() writes.
+ */
+static int
+reference_pp_stream_read(struct reference *reference, unsigned int physical,
+			 int tile_max)
+{
+	struct limare_state *state = reference->state;
+	struct reference_tile *tile = NULL;
+	struct lima_cmd *cmd;
+	int i;
+
+	/* a position and an address per tile, and the end. */
+	for (i = 0; i <= (2 * tile_max); i++) {
+		cmd = limare_mem_address(state, physical + 8 * i,
+					 sizeof(struct lima_cmd));
+		if (!cmd) {
+			printf("%s: Error: pp stream 0x%08x runs out of our "
+			       "memory\n", __func__, physical);
+			return -1;
+		}
+
+		if (cmd->cmd == 0xBC000000) {
+			if (tile) {
+				printf("%s: Error: tile (%d, %d) has no "
+				       "block\n", __func__, tile->x, tile->y);
+				return -1;
+			}
+			return 0;
+		} else if ((cmd->cmd & 0xFF000000) == 0xB8000000) {
+			if (tile || (reference->tile_count == tile_max)) {
+				printf("%s: Error: pp stream 0x%08x: "
+				       "unexpected tile\n", __func__, physical);
+				return -1;
+			}
+
+			tile = &reference->tiles[reference->tile_count];
+			tile->x = cmd->cmd & 0xFF;
+			tile->y = (cmd->cmd >> 8) & 0xFF;
+		} else if ((cmd->cmd == 0xB0000000) && tile &&
+			   ((cmd->val & 0xE0000000) == 0xE0000000)) {
+			unsigned int block = (cmd->val & ~0xE0000003) << 3;
+
+			tile->block = reference_block_find(reference, block);
+			if (tile->block < 0) {
+				printf("%s: Error: tile (%d, %d) points to "
+				       "0x%08x, which is not a plb block\n",
+				       __func__, tile->x, tile->y, block);
+				return -1;
+			}
+
+			reference->tile_count++;
+			tile = NULL;
+		} else {
+			printf("%s: Error: pp stream 0x%08x: unknown command "
+			       "0x%08x 0x%08x\n", __func__, physical, cmd->val,
+			       cmd->cmd);
+			return -1;
+		}
+	}
+
+	printf("%s: Error: pp stream 0x%08x is not terminated\n", __func__,
+	       physical);
+	return -1;
+}
+
+/*
+ * Every tile of the plb has to be rendered by exactly one of the streams.
+ */
+static int
+reference_pp_streams_read(struct reference *reference)
+{
+	struct decode_plb *plb = reference->plb;
+	int tile_max = plb->tiles_w * plb->tiles_h;
+	char *seen;
+	int i, ret = 0;
+
+	if (!plb->pp_stream_count) {
+		printf("%s: Error: no pp streams were started\n", __func__);
+		return -1;
+	}
+
+	reference->tiles = calloc(tile_max, sizeof(struct reference_tile));
+	seen = calloc(tile_max, 1);
+	if (!reference->tiles || !seen) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		free(seen);
+		return -1;
+	}
+
+	for (i = 0; i < plb->pp_stream_count; i++) {
+		ret = reference_pp_stream_read(reference, plb->pp_streams[i],
+					       tile_max);
+		if (ret)
+			goto done;
+	}
+
+	for (i = 0; i < reference->tile_count; i++) {
+		struct reference_tile *tile = &reference->tiles[i];
+
+		if ((tile->x >= plb->tiles_w) || (tile->y >= plb->tiles_h)) {
+			printf("%s: Error: tile (%d, %d) is outside of the "
+			       "plb\n", __func__, tile->x, tile->y);
+			ret = -1;
+			goto done;
+		}
+
+		if (seen[tile->y * plb->tiles_w + tile->x]++) {
+			printf("%s: Error: tile (%d, %d) is rendered twice\n",
+			       __func__, tile->x, tile->y);
+			ret = -1;
+			goto done;
+		}
+	}
+
+	if (reference->tile_count != tile_max) {
+		printf("%s: Error: %d of %d tiles are not rendered\n",
+		       __func__, tile_max - reference->tile_count, tile_max);
+		ret = -1;
+	}
+
+ done:
+	free(seen);
+	return ret;
+}
+
+/* 4x rotated grid, as offsets into the pixel. */
+static const float reference_samples[4][2] = {
+	{ 0.375, 0.125 },
+	{ 0.875, 0.375 },
+	{ 0.125, 0.625 },
+	{ 0.625, 0.875 },
+};
+
+/*
+ * Barycentric weights of a point, positive inside for either winding.
+ */
+static void
+reference_weights(struct reference_triangle *triangle, float x, float y,
+		  float *weights)
+{
+	struct reference_vertex *v = triangle->vertices;
+
+	weights[0] = ((v[1].x - x) * (v[2].y - y) -
+		      (v[2].x - x) * (v[1].y - y)) / triangle->area;
+	weights[1] = ((v[2].x - x) * (v[0].y - y) -
+		      (v[0].x - x) * (v[2].y - y)) / triangle->area;
+	weights[2] = 1.0 - weights[0] - weights[1];
+}
+
+static void
+reference_pixel_shade(struct reference *reference,
+		      struct reference_triangle *triangle, int x, int y)
+{
+	struct limare_state *state = reference->state;
+	struct reference_vertex *v = triangle->vertices;
+	unsigned int *pixel;
+	float weights[3], color[4], old[4], coverage = 0.0, w_sum;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		reference_weights(triangle, x + reference_samples[i][0],
+				  y + reference_samples[i][1], weights);
+		if ((weights[0] >= 0.0) && (weights[1] >= 0.0) &&
+		    (weights[2] >= 0.0))
+			coverage += 0.25;
+	}
+
+	if (!coverage)
+		return;
+
+	/* colour is taken at the centre, perspective corrected. */
+	reference_weights(triangle, x + 0.5, y + 0.5, weights);
+	for (i = 0; i < 3; i++)
+		weights[i] *= v[i].w_inv;
+	w_sum = weights[0] + weights[1] + weights[2];
+	if (w_sum != 0.0)
+		for (i = 0; i < 3; i++)
+			weights[i] /= w_sum;
+
+	for (i = 0; i < 4; i++)
+		color[i] = weights[0] * v[0].color[i] +
+			weights[1] * v[1].color[i] +
+			weights[2] * v[2].color[i];
+
+	pixel = &reference->buffer[y * state->width + x];
+
+	/* partially covered pixels get resolved against what was there. */
+	if (coverage < 1.0) {
+		reference_pixel_unpack(state, *pixel, old);
+		for (i = 0; i < 4; i++)
+			color[i] = coverage * color[i] +
+				(1.0 - coverage) * old[i];
+	}
+
+	*pixel = reference_pixel_pack(state, color);
+}
+
+static void
+reference_tile_render(struct reference *reference,
+		      struct reference_tile *tile)
+{
+	struct limare_state *state = reference->state;
+	int x0 = tile->x * REFERENCE_TILE_SIZE;
+	int y0 = tile->y * REFERENCE_TILE_SIZE;
+	int x1 = x0 + REFERENCE_TILE_SIZE - 1;
+	int y1 = y0 + REFERENCE_TILE_SIZE - 1;
+	int i, x, y;
+
+	/* the plb is aligned to whole blocks, the frame is not. */
+	if ((x0 >= state->width) || (y0 >= state->height))
+		return;
+
+	if (x1 >= state->width)
+		x1 = state->width - 1;
+	if (y1 >= state->height)
+		y1 = state->height - 1;
+
+	for (y = y0; y <= y1; y++)
+		for (x = x0; x <= x1; x++)
+			reference->buffer[y * state->width + x] =
+				state->clear_color;
+
+	for (i = reference->block_start[tile->block];
+	     i < reference->block_start[tile->block + 1]; i++) {
+		struct reference_triangle *triangle =
+			&reference->triangles[reference->block_triangles[i]];
+		int tx0 = (triangle->x0 > x0) ? triangle->x0 : x0;
+		int ty0 = (triangle->y0 > y0) ? triangle->y0 : y0;
+		int tx1 = (triangle->x1 < x1) ? triangle->x1 : x1;
+		int ty1 = (triangle->y1 < y1) ? triangle->y1 : y1;
+
+		for (y = ty0; y <= ty1; y++)
+			for (x = tx0; x <= tx1; x++)
+				reference_pixel_shade(reference, triangle,
+						      x, y);
+	}
+}
+
+/*
+ * Threads take tiles in stream order, much like the pp cores would.
+ */
+static void *
+reference_thread(void *data)
+{
+	struct reference *reference = data;
+	int tile;
+
+	while (1) {
+		pthread_mutex_lock(&reference->mutex);
+		tile = reference->tile_next++;
+		pthread_mutex_unlock(&reference->mutex);
+
+		if (tile >= reference->tile_count)
+			break;
+
+		reference_tile_render(reference, &reference->tiles[tile]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Renders into buffer, which is laid out like the pp output of the frame.
+ * A thread_count of 0 uses all online cpus.
+ */
+int
+reference_render(struct limare_state *state, struct decode *decode,
+		 unsigned int *buffer, int thread_count)
+{
+	struct reference reference[1] = {{ 0 }};
+	pthread_t threads[REFERENCE_THREADS_MAX];
+	int i, ret = 0;
+
+	reference->state = state;
+	reference->plb = &decode->plb;
+	reference->buffer = buffer;
+
+	ret = reference_blocks_get(reference);
+	if (ret)
+		goto done;
+
+	ret = reference_pp_streams_read(reference);
+	if (ret)
+		goto done;
+
+	for (i = 0; i < decode->draw_count; i++) {
+		ret = reference_draw_add(reference, &decode->draws[i]);
+		if (ret)
+			goto done;
+	}
+
+	ret = reference_bin(reference);
+	if (ret)
+		goto done;
+
+	if (thread_count <= 0)
+		thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count <= 0)
+		thread_count = 1;
+	if (thread_count > REFERENCE_THREADS_MAX)
+		thread_count = REFERENCE_THREADS_MAX;
+
+	pthread_mutex_init(&reference->mutex, NULL);
+
+	/* the calling thread takes part as well. */
+	for (i = 0; i < (thread_count - 1); i++)
+		if (pthread_create(&threads[i], NULL, reference_thread,
+				   reference))
+			break;
+	thread_count = i;
+
+	reference_thread(reference);
+
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&reference->mutex);
+
+ done:
+	free(reference->triangles);
+	free(reference->block_physical);
+	free(reference->block_start);
+	free(reference->block_triangles);
+	free(reference->tiles);
+
+	return ret;
+}
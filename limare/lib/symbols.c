@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "symbols.h"
+#include "arena.h"
 
 struct symbol *
 symbol_create(const char *name, enum symbol_type type,
@@ -87,14 +88,17 @@ symbol_create(const char *name, enum symbol_type type,
 	return symbol;
 }
 
+/*
+ * Copies only live for a frame, so they come from the frame arena.
+ */
 struct symbol *
-symbol_copy(struct symbol *original, int start, int count)
+symbol_copy(struct arena *arena, struct symbol *original, int start, int count)
 {
 	struct symbol *symbol;
 
-	symbol = malloc(sizeof(struct symbol));
+	symbol = arena_alloc(arena, sizeof(struct symbol));
 	if (!symbol) {
-		printf("%s: failed to allocate: %s\n", __func__, strerror(errno));
+		printf("%s: failed to allocate\n", __func__);
 		return NULL;
 	}
 
@@ -110,6 +114,10 @@ symbol_copy(struct symbol *original, int start, int count)
 		symbol->data = original->data +
 			symbol->component_size * symbol->component_count * start;
 
+	if (original->data_physical)
+		symbol->data_physical = original->data_physical +
+			symbol->component_size * symbol->component_count * start;
+
 	return symbol;
 }
 
@@ -56,6 +56,10 @@ struct symbol {
 
 	void *data;
 	int data_allocated;
+
+	/* set when data lives in a buffer object, so no copy is needed. */
+	unsigned int data_physical;
+	int data_streamed; /* in frame memory, only valid for this frame */
 };
 
 struct symbol *symbol_create(const char *name, enum symbol_type type,
@@ -63,7 +67,9 @@ struct symbol *symbol_create(const char *name, enum symbol_type type,
 			     int entry_count, int src_stride, int dst_stride,
 			     void *data, int copy, int matrix);
 
-struct symbol *symbol_copy(struct symbol *original, int start, int count);
+struct arena;
+struct symbol *symbol_copy(struct arena *arena, struct symbol *original,
+			   int start, int count);
 
 void symbol_destroy(struct symbol *symbol);
 void symbol_print(struct symbol *symbol);
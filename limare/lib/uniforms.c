@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Per frame cache of packed uniform blocks. Blocks are keyed on a hash of
+ * their contents, and only live as long as the frame memory they sit in.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uniforms.h"
+
+struct uniform_cache *
+uniform_cache_create(void)
+{
+	struct uniform_cache *cache;
+
+	cache = calloc(1, sizeof(struct uniform_cache));
+	if (!cache) {
+		printf("%s: Error: failed to allocate: %s\n",
+		       __func__, strerror(errno));
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void
+uniform_block_list_free(struct uniform_block *block)
+{
+	while (block) {
+		struct uniform_block *next = block->next;
+
+		free(block->data);
+		free(block);
+		block = next;
+	}
+}
+
+void
+uniform_cache_destroy(struct uniform_cache *cache)
+{
+	uniform_block_list_free(cache->used);
+	uniform_block_list_free(cache->free);
+	free(cache->scratch);
+	free(cache);
+}
+
+void *
+uniform_cache_scratch(struct uniform_cache *cache, int size)
+{
+	if (size > cache->scratch_size) {
+		void *scratch = realloc(cache->scratch, size);
+
+		if (!scratch) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			return NULL;
+		}
+
+		cache->scratch = scratch;
+		cache->scratch_size = size;
+	}
+
+	memset(cache->scratch, 0, size);
+
+	return cache->scratch;
+}
+
+/* FNV-1a */
+unsigned int
+uniform_block_hash(int type, void *data, int size)
+{
+	unsigned char *bytes = data;
+	unsigned int hash = 0x811C9DC5 ^ type;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/*
+ * Returns 1 and fills in physical when an identical block exists already.
+ */
+int
+uniform_cache_lookup(struct uniform_cache *cache, unsigned int hash,
+		     int type, void *data, int size, unsigned int *physical)
+{
+	struct uniform_block *block;
+
+	cache->lookups++;
+
+	for (block = cache->buckets[hash % UNIFORM_CACHE_BUCKETS];
+	     block; block = block->hash_next) {
+		if ((block->hash == hash) && (block->type == type) &&
+		    (block->size == size) && !memcmp(block->data, data, size)) {
+			cache->hits++;
+			*physical = block->physical;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+uniform_cache_insert(struct uniform_cache *cache, unsigned int hash,
+		     int type, void *data, int size, unsigned int physical)
+{
+	struct uniform_block *block;
+	int bucket;
+
+	if (cache->free) {
+		block = cache->free;
+		cache->free = block->next;
+	} else {
+		block = calloc(1, sizeof(struct uniform_block));
+		if (!block) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (size > block->data_size) {
+		void *block_data = realloc(block->data, size);
+
+		if (!block_data) {
+			printf("%s: Error: failed to allocate: %s\n",
+			       __func__, strerror(errno));
+			block->next = cache->free;
+			cache->free = block;
+			return -1;
+		}
+
+		block->data = block_data;
+		block->data_size = size;
+	}
+
+	memcpy(block->data, data, size);
+	block->hash = hash;
+	block->type = type;
+	block->size = size;
+	block->physical = physical;
+
+	bucket = block->hash % UNIFORM_CACHE_BUCKETS;
+	block->hash_next = cache->buckets[bucket];
+	cache->buckets[bucket] = block;
+
+	block->next = cache->used;
+	cache->used = block;
+
+	return 0;
+}
+
+/*
+ * The memory of the previous frame is no longer ours to reference.
+ */
+void
+uniform_cache_reset(struct uniform_cache *cache)
+{
+	struct uniform_block *block = cache->used;
+
+	while (block) {
+		struct uniform_block *next = block->next;
+
+		block->next = cache->free;
+		cache->free = block;
+		block = next;
+	}
+
+	cache->used = NULL;
+	memset(cache->buckets, 0, sizeof(cache->buckets));
+}
+
+void
+uniform_cache_print(struct uniform_cache *cache)
+{
+	printf("Uniform blocks: %u lookups, %u hits (%u%%)\n",
+	       cache->lookups, cache->hits,
+	       cache->lookups ? (100 * cache->hits / cache->lookups) : 0);
+}
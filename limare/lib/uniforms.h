@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Per frame cache of packed uniform blocks, so that draws with identical
+ * uniforms share a single block in gpu memory.
+ */
+
+#ifndef LIMARE_UNIFORMS_H
+#define LIMARE_UNIFORMS_H 1
+
+#define UNIFORM_BLOCK_VERTEX 0
+#define UNIFORM_BLOCK_FRAGMENT 1
+
+struct uniform_block {
+	unsigned int hash;
+	int type;
+
+	/* host copy of the packed contents, to rule out hash collisions. */
+	void *data;
+	int size;
+	int data_size; /* allocated */
+
+	unsigned int physical;
+
+	struct uniform_block *hash_next;
+	struct uniform_block *next;
+};
+
+#define UNIFORM_CACHE_BUCKETS 64
+
+struct uniform_cache {
+	struct uniform_block *buckets[UNIFORM_CACHE_BUCKETS];
+
+	/* blocks of the current frame, and blocks kept for reuse. */
+	struct uniform_block *used;
+	struct uniform_block *free;
+
+	/* packing area, a block is built here before it gets looked up. */
+	void *scratch;
+	int scratch_size;
+
+	unsigned int lookups;
+	unsigned int hits;
+};
+
+struct uniform_cache *uniform_cache_create(void);
+void uniform_cache_destroy(struct uniform_cache *cache);
+
+void *uniform_cache_scratch(struct uniform_cache *cache, int size);
+
+unsigned int uniform_block_hash(int type, void *data, int size);
+
+int uniform_cache_lookup(struct uniform_cache *cache, unsigned int hash,
+			 int type, void *data, int size,
+			 unsigned int *physical);
+int uniform_cache_insert(struct uniform_cache *cache, unsigned int hash,
+			 int type, void *data, int size,
+			 unsigned int physical);
+
+void uniform_cache_reset(struct uniform_cache *cache);
+void uniform_cache_print(struct uniform_cache *cache);
+
+#endif /* LIMARE_UNIFORMS_H */
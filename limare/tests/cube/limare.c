@@ -42,6 +42,7 @@ int
 main(int argc, char *argv[])
 {
 	struct limare_state *state;
+	struct limare_buffer *buffer;
 	int ret;
 
 	const char *vertex_shader_source =
@@ -192,9 +193,23 @@ main(int argc, char *argv[])
 
 	limare_link(state);
 
-	limare_attribute_pointer(state, "in_position", 4, 3, vVertices);
-	limare_attribute_pointer(state, "in_color", 4, 3, vColors);
-	limare_attribute_pointer(state, "in_normal", 4, 3, vNormals);
+	/* the cube never changes, so keep it in gpu memory. */
+	buffer = limare_buffer_create(state, sizeof(vVertices) +
+				      sizeof(vColors) + sizeof(vNormals));
+	if (!buffer)
+		return -1;
+
+	limare_buffer_upload(buffer, 0, vVertices, sizeof(vVertices));
+	limare_buffer_upload(buffer, sizeof(vVertices),
+			     vColors, sizeof(vColors));
+	limare_buffer_upload(buffer, sizeof(vVertices) + sizeof(vColors),
+			     vNormals, sizeof(vNormals));
+
+	limare_attribute_buffer(state, "in_position", 4, 3, buffer, 0);
+	limare_attribute_buffer(state, "in_color", 4, 3, buffer,
+				sizeof(vVertices));
+	limare_attribute_buffer(state, "in_normal", 4, 3, buffer,
+				sizeof(vVertices) + sizeof(vColors));
 
 	ESMatrix modelview;
 	esMatrixLoadIdentity(&modelview);
@@ -252,11 +267,14 @@ main(int argc, char *argv[])
 	if (ret)
 		return ret;
 
+	/* all six faces share their uniforms. */
+	limare_uniform_stats_print(state);
+
 	bmp_dump(state->pp->frame_address, state, "/sdcard/limare.bmp");
 
 	fb_dump(state->pp->frame_address, 0, state->width, state->height);
 
-	limare_finish();
+	limare_finish(state);
 
 	return 0;
 }
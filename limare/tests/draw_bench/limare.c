@@ -0,0 +1,369 @@
+/*
+ * Copyright 2011-2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Measures the cpu cost of building frames, over sweeps of draws per frame,
+ * attributes per draw, vertex uniform vec4s and vertices per draw.
+ *
+ * Runs on the simulated backend, unless LIMARE_BACKEND says otherwise, and
+ * writes one csv line per combination, see README.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <GLES2/gl2.h>
+
+#include "limare.h"
+#include "program.h"
+
+#define WIDTH 800
+#define HEIGHT 480
+
+#define SWEEP_MAX 16
+#define ATTRIBUTES_MAX 16
+#define UNIFORMS_MAX 64
+
+struct sweep {
+	int values[SWEEP_MAX];
+	int count;
+};
+
+static struct sweep draws_sweep = {{ 1, 16, 128 }, 3 };
+static struct sweep attributes_sweep = {{ 1, 2, 4 }, 3 };
+static struct sweep uniforms_sweep = {{ 1, 4, 16 }, 3 };
+static struct sweep vertices_sweep = {{ 3, 48, 384 }, 3 };
+
+static int frames = 20;
+static int warmup = 2;
+
+static float *attribute_data[ATTRIBUTES_MAX];
+static float uniform_data[UNIFORMS_MAX][4];
+
+static long long
+nsecs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+static int
+sweep_parse(struct sweep *sweep, char *list, int max)
+{
+	char *next;
+
+	sweep->count = 0;
+
+	while (*list) {
+		if (sweep->count == SWEEP_MAX) {
+			fprintf(stderr, "Error: too many values\n");
+			return -1;
+		}
+
+		sweep->values[sweep->count] = strtol(list, &next, 0);
+		if ((next == list) || (sweep->values[sweep->count] < 1) ||
+		    (sweep->values[sweep->count] > max)) {
+			fprintf(stderr, "Error: invalid value in \"%s\"\n",
+				list);
+			return -1;
+		}
+		sweep->count++;
+
+		if (*next == ',')
+			next++;
+		list = next;
+	}
+
+	return sweep->count ? 0 : -1;
+}
+
+static int
+sweep_max(struct sweep *sweep)
+{
+	int i, max = 0;
+
+	for (i = 0; i < sweep->count; i++)
+		if (sweep->values[i] > max)
+			max = sweep->values[i];
+
+	return max;
+}
+
+static void
+usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-d draws] [-a attributes] [-u uniforms] "
+		"[-v vertices] [-f frames] [-o file]\n", name);
+	fprintf(stderr, "Sweeps take comma separated lists, "
+		"e.g. -d 1,16,128.\n");
+}
+
+/*
+ * The shaders use everything, so that the compiler keeps it all around.
+ */
+static int
+program_setup(struct limare_state *state, int attributes, int uniforms)
+{
+	char vertex[4096], *p = vertex;
+	const char *fragment =
+		"precision mediump float;\n"
+		"varying vec4 vColor;\n"
+		"void main()\n"
+		"{\n"
+		"    gl_FragColor = vColor;\n"
+		"}\n";
+	int i;
+
+	p += sprintf(p, "attribute vec4 aPosition;\n");
+	for (i = 1; i < attributes; i++)
+		p += sprintf(p, "attribute vec4 aAttribute%d;\n", i);
+	for (i = 0; i < uniforms; i++)
+		p += sprintf(p, "uniform vec4 uData%d;\n", i);
+	p += sprintf(p, "varying vec4 vColor;\n"
+		     "void main()\n"
+		     "{\n"
+		     "    vColor = vec4(0.0)");
+	for (i = 1; i < attributes; i++)
+		p += sprintf(p, " + aAttribute%d", i);
+	for (i = 0; i < uniforms; i++)
+		p += sprintf(p, " + uData%d", i);
+	p += sprintf(p, ";\n"
+		     "    gl_Position = aPosition;\n"
+		     "}\n");
+
+	if (vertex_shader_attach(state, vertex))
+		return -1;
+	if (fragment_shader_attach(state, fragment))
+		return -1;
+
+	return limare_link(state);
+}
+
+static int
+frame_build(struct limare_state *state, int draws, int attributes,
+	    int uniforms, int vertices, long long *draw_time,
+	    long long *uniform_time)
+{
+	char name[32];
+	long long start;
+	int i, j, ret;
+
+	for (i = 0; i < draws; i++) {
+		start = nsecs();
+
+		for (j = 0; j < uniforms; j++) {
+			/* differs per draw, so it defeats the uniform cache. */
+			uniform_data[j][0] = i;
+
+			sprintf(name, "uData%d", j);
+			ret = limare_uniform_attach(state, name, 4, 4,
+						    uniform_data[j]);
+			if (ret)
+				return ret;
+		}
+
+		*uniform_time += nsecs() - start;
+		start = nsecs();
+
+		ret = limare_attribute_pointer(state, "aPosition", 4, 4,
+					       attribute_data[0]);
+		if (ret)
+			return ret;
+
+		for (j = 1; j < attributes; j++) {
+			sprintf(name, "aAttribute%d", j);
+			ret = limare_attribute_pointer(state, name, 4, 4,
+						       attribute_data[j]);
+			if (ret)
+				return ret;
+		}
+
+		ret = limare_draw_arrays(state, GL_TRIANGLES, 0, vertices);
+		if (ret)
+			return ret;
+
+		*draw_time += nsecs() - start;
+	}
+
+	return 0;
+}
+
+static int
+bench_run(struct limare_state *state, FILE *out, int draws, int attributes,
+	  int uniforms, int vertices)
+{
+	struct limare_stats before, after;
+	long long draw_time = 0, uniform_time = 0, flush_time = 0, start;
+	long long total_draws = (long long) frames * draws;
+	int i, ret;
+
+	for (i = 0; i < (warmup + frames); i++) {
+		long long dummy_draw = 0, dummy_uniform = 0;
+
+		if (i == warmup)
+			limare_stats_get(state, &before);
+
+		if (i < warmup)
+			ret = frame_build(state, draws, attributes, uniforms,
+					  vertices, &dummy_draw,
+					  &dummy_uniform);
+		else
+			ret = frame_build(state, draws, attributes, uniforms,
+					  vertices, &draw_time,
+					  &uniform_time);
+		if (ret)
+			return ret;
+
+		start = nsecs();
+		ret = limare_flush(state);
+		if (ret)
+			return ret;
+		if (i >= warmup)
+			flush_time += nsecs() - start;
+	}
+
+	limare_stats_get(state, &after);
+
+	fprintf(out, "%d,%d,%d,%d,%d,%lld,%lld,%lld,%.1f,%.1f\n",
+		draws, attributes, uniforms, vertices, frames,
+		draw_time / total_draws,
+		uniforms ? (uniform_time / (total_draws * uniforms)) : 0,
+		flush_time / frames,
+		(double) (after.bytes_copied - before.bytes_copied) /
+		total_draws,
+		(double) (after.allocations - before.allocations) /
+		total_draws);
+	fflush(out);
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct limare_state *state;
+	FILE *out = stdout;
+	int max_vertices, max_draws, max_attributes;
+	int a, u, d, v, i, j, opt, ret;
+
+	while ((opt = getopt(argc, argv, "d:a:u:v:f:o:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			ret = sweep_parse(&draws_sweep, optarg, 4096);
+			break;
+		case 'a':
+			ret = sweep_parse(&attributes_sweep, optarg,
+					  ATTRIBUTES_MAX);
+			break;
+		case 'u':
+			ret = sweep_parse(&uniforms_sweep, optarg,
+					  UNIFORMS_MAX);
+			break;
+		case 'v':
+			ret = sweep_parse(&vertices_sweep, optarg, 65535);
+			break;
+		case 'f':
+			frames = atoi(optarg);
+			ret = (frames < 1) ? -1 : 0;
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			ret = out ? 0 : -1;
+			break;
+		default:
+			ret = -1;
+			break;
+		}
+
+		if (ret) {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	/* only the cpu side is measured, so the hardware is not needed. */
+	setenv("LIMARE_BACKEND", "sim", 0);
+
+	max_draws = sweep_max(&draws_sweep);
+	max_attributes = sweep_max(&attributes_sweep);
+	max_vertices = sweep_max(&vertices_sweep);
+
+	for (i = 0; i < max_attributes; i++) {
+		attribute_data[i] = calloc(4 * max_vertices, sizeof(float));
+		if (!attribute_data[i])
+			return -1;
+
+		for (j = 0; j < (4 * max_vertices); j++)
+			attribute_data[i][j] = (j % 7) / 7.0;
+	}
+
+	state = limare_init();
+	if (!state)
+		return -1;
+
+	/* room for the largest frame, twice, as the previous one retires. */
+	state->draw_mem_size = 2 * max_draws *
+		(0x400 + ALIGN(16 * max_vertices, 0x40) * (max_attributes + 2));
+
+	ret = limare_state_setup(state, WIDTH, HEIGHT, 0xFF505050);
+	if (ret)
+		return ret;
+
+	fprintf(out, "draws,attributes,uniforms,vertices,frames,"
+		"ns_per_draw,ns_per_uniform,ns_per_flush,"
+		"bytes_per_draw,allocations_per_draw\n");
+
+	for (a = 0; a < attributes_sweep.count; a++)
+		for (u = 0; u < uniforms_sweep.count; u++) {
+			ret = program_setup(state, attributes_sweep.values[a],
+					    uniforms_sweep.values[u]);
+			if (ret)
+				return ret;
+
+			for (d = 0; d < draws_sweep.count; d++)
+				for (v = 0; v < vertices_sweep.count; v++) {
+					ret = bench_run(state, out,
+						draws_sweep.values[d],
+						attributes_sweep.values[a],
+						uniforms_sweep.values[u],
+						vertices_sweep.values[v]);
+					if (ret)
+						return ret;
+				}
+		}
+
+	limare_finish(state);
+	limare_fini(state);
+
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
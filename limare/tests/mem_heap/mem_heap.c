@@ -0,0 +1,369 @@
+/*
+ * Copyright 2011-2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Exercises the gpu memory sub-allocator without a device: heaps on top of
+ * plain host memory, and big blocks from a fake backend.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define u32 uint32_t
+#include "linux/mali_ioctl.h"
+
+#include "limare.h"
+#include "mem.h"
+#include "backend.h"
+
+/* deliberately not page aligned, so that alignment is of the address. */
+#define HEAP_PHYSICAL 0x40000040
+#define HEAP_SIZE 0x10000
+
+#define BLOCK_PHYSICAL 0x50000000
+
+static int failures;
+
+#define CHECK(x) \
+	do { \
+		if (!(x)) { \
+			printf("%s:%d: Error: %s\n", __func__, __LINE__, #x); \
+			failures++; \
+		} \
+	} while (0)
+
+static int
+heap_chunk_count(struct mem_heap *heap)
+{
+	struct mem_chunk *chunk;
+	int count = 0;
+
+	for (chunk = heap->chunks; chunk; chunk = chunk->next)
+		count++;
+
+	return count;
+}
+
+static void
+test_alignment(void)
+{
+	struct mem_heap *heap;
+	int a, b;
+
+	heap = mem_heap_create(HEAP_PHYSICAL, NULL, HEAP_SIZE);
+
+	/* sizes get rounded up to the default alignment. */
+	a = mem_heap_alloc(heap, 1, 0);
+	CHECK(a == 0);
+	CHECK(heap->used == MEM_ALIGN_DEFAULT);
+
+	/* and page alignment is of the physical address. */
+	b = mem_heap_alloc(heap, 0x100, MEM_ALIGN_PAGE);
+	CHECK(b >= 0);
+	CHECK(!((HEAP_PHYSICAL + b) & (MEM_ALIGN_PAGE - 1)));
+
+	/* the padding in front stays available. */
+	a = mem_heap_alloc(heap, 0x40, MEM_ALIGN_DEFAULT);
+	CHECK(a == MEM_ALIGN_DEFAULT);
+
+	CHECK(mem_heap_alloc(heap, 0, 0) == -1);
+
+	mem_heap_destroy(heap);
+}
+
+static void
+test_first_fit(void)
+{
+	struct mem_heap *heap;
+	int a, b, c, d;
+
+	heap = mem_heap_create(HEAP_PHYSICAL, NULL, HEAP_SIZE);
+
+	a = mem_heap_alloc(heap, 0x100, 0);
+	b = mem_heap_alloc(heap, 0x100, 0);
+	c = mem_heap_alloc(heap, 0x100, 0);
+	CHECK((a == 0) && (b == 0x100) && (c == 0x200));
+
+	/* a hole that fits gets reused, the first one that does. */
+	CHECK(!mem_heap_free(heap, b));
+	d = mem_heap_alloc(heap, 0x80, 0);
+	CHECK(d == b);
+	d = mem_heap_alloc(heap, 0x100, 0);
+	CHECK(d == 0x300);
+
+	/* freeing twice, a free chunk, or inside a chunk, is refused. */
+	CHECK(mem_heap_free(heap, b) == 0);
+	CHECK(mem_heap_free(heap, b) == -1);
+	CHECK(mem_heap_free(heap, b + 0x80) == -1);
+	CHECK(mem_heap_free(heap, a + 0x40) == -1);
+
+	mem_heap_destroy(heap);
+}
+
+static void
+test_merge(void)
+{
+	struct mem_heap *heap;
+	int a, b, c;
+
+	heap = mem_heap_create(HEAP_PHYSICAL, NULL, HEAP_SIZE);
+
+	a = mem_heap_alloc(heap, 0x100, 0);
+	b = mem_heap_alloc(heap, 0x100, 0);
+	c = mem_heap_alloc(heap, 0x100, 0);
+	CHECK(heap_chunk_count(heap) == 4);
+
+	/* with the next neighbour, */
+	CHECK(!mem_heap_free(heap, c));
+	CHECK(heap_chunk_count(heap) == 3);
+
+	/* with the previous one, */
+	CHECK(!mem_heap_free(heap, a));
+	CHECK(!mem_heap_free(heap, b));
+	CHECK(heap_chunk_count(heap) == 1);
+
+	/* and the whole heap is one piece again. */
+	CHECK(heap->used == 0);
+	CHECK(mem_heap_alloc(heap, HEAP_SIZE, 0) == 0);
+
+	mem_heap_destroy(heap);
+}
+
+static void
+test_exhaustion(void)
+{
+	struct mem_heap *heap;
+	int i, offset;
+
+	heap = mem_heap_create(HEAP_PHYSICAL, NULL, HEAP_SIZE);
+
+	for (i = 0; i < (HEAP_SIZE / 0x1000); i++)
+		CHECK(mem_heap_alloc(heap, 0x1000, 0) == (i * 0x1000));
+
+	CHECK(heap->used == HEAP_SIZE);
+	CHECK(mem_heap_alloc(heap, 1, 0) == -1);
+
+	/* free room, but not aligned as asked. */
+	CHECK(!mem_heap_free(heap, 0x1000));
+	offset = mem_heap_alloc(heap, 0x1000, MEM_ALIGN_PAGE);
+	CHECK(offset == -1);
+	CHECK(mem_heap_alloc(heap, 0x1000, 0) == 0x1000);
+
+	CHECK(mem_heap_alloc(heap, HEAP_SIZE + 1, 0) == -1);
+
+	mem_heap_destroy(heap);
+}
+
+/*
+ * Big blocks come from host memory, at made up physical addresses.
+ */
+static unsigned int block_physical = BLOCK_PHYSICAL;
+static int block_count;
+
+static int
+test_big_block_get(struct limare_state *state, int size,
+		   unsigned int *physical, int *real_size,
+		   unsigned int *cookie)
+{
+	*physical = block_physical;
+	*real_size = size;
+	*cookie = block_physical;
+
+	block_physical += size;
+	block_count++;
+
+	return 0;
+}
+
+static void
+test_big_block_free(struct limare_state *state, unsigned int cookie)
+{
+	block_count--;
+}
+
+static void *
+test_mmap(struct limare_state *state, unsigned int physical, int size)
+{
+	return malloc(size);
+}
+
+static void
+test_munmap(struct limare_state *state, void *address, int size)
+{
+	free(address);
+}
+
+static const struct limare_backend test_backend = {
+	.name = "test",
+	.mmap = test_mmap,
+	.munmap = test_munmap,
+	.big_block_get = test_big_block_get,
+	.big_block_free = test_big_block_free,
+};
+
+static void
+test_big_blocks(void)
+{
+	struct limare_state *state = calloc(1, sizeof(struct limare_state));
+	unsigned int a, b, c;
+
+	state->backend = &test_backend;
+	state->mem_heap = mem_heap_create(HEAP_PHYSICAL, malloc(HEAP_SIZE),
+					  HEAP_SIZE);
+	state->mem_total = HEAP_SIZE;
+
+	/* fits in the initial heap. */
+	CHECK(limare_mem_alloc(state, 0x100, 0, &a));
+	CHECK(a == HEAP_PHYSICAL);
+	CHECK(block_count == 0);
+
+	/* grows a block, and the next one does not fit in there anymore. */
+	CHECK(limare_mem_alloc(state, 0x80000, 0, &b));
+	CHECK(block_count == 1);
+	CHECK(limare_mem_alloc(state, 0x88000, MEM_ALIGN_PAGE, &c));
+	CHECK(block_count == 2);
+	CHECK(state->mem_total == (HEAP_SIZE + 2 * MEM_BLOCK_SIZE));
+	CHECK(state->mem_used_max == (0x100 + 0x80000 + 0x88000));
+
+	/* the host side address matches the physical one. */
+	CHECK(limare_mem_address(state, b, 0x80000) ==
+	      state->mem_heap->next->address);
+	CHECK(!limare_mem_address(state, b, MEM_BLOCK_SIZE + 1));
+
+	/* we hold more than the high water mark without this block. */
+	limare_mem_free(state, b);
+	limare_mem_trim(state);
+	CHECK(block_count == 1);
+	CHECK(state->mem_total == (HEAP_SIZE + MEM_BLOCK_SIZE));
+
+	/* but not without this one. */
+	limare_mem_free(state, c);
+	limare_mem_trim(state);
+	CHECK(block_count == 1);
+	CHECK(state->mem_used == 0x100);
+
+	/* which then gets reused instead of growing again. */
+	CHECK(limare_mem_alloc(state, 0x88000, 0, &c));
+	CHECK(block_count == 1);
+
+	limare_mem_free(state, c);
+	limare_mem_free(state, a);
+	CHECK(state->mem_used == 0);
+
+	/* not ours. */
+	limare_mem_free(state, 0x1000);
+	CHECK(state->mem_used == 0);
+
+	while (state->mem_heap->next) {
+		struct mem_heap *heap = state->mem_heap->next;
+
+		state->mem_heap->next = heap->next;
+		free(heap->address);
+		mem_heap_destroy(heap);
+	}
+	free(state->mem_heap->address);
+	mem_heap_destroy(state->mem_heap);
+	free(state);
+}
+
+static void
+test_deferred(void)
+{
+	struct limare_state *state = calloc(1, sizeof(struct limare_state));
+	unsigned int a, b, c;
+
+	state->mem_heap = mem_heap_create(HEAP_PHYSICAL, malloc(HEAP_SIZE),
+					  HEAP_SIZE);
+	state->mem_total = HEAP_SIZE;
+
+	CHECK(limare_mem_alloc(state, 0x100, 0, &a));
+	CHECK(limare_mem_alloc(state, 0x100, 0, &b));
+
+	/* serials wrap. */
+	limare_mem_free_deferred(state, a, 0xFFFFFFFF);
+	limare_mem_free_deferred(state, b, 0);
+
+	/* so nothing can land on top of it before the frame retires. */
+	CHECK(limare_mem_alloc(state, 0x100, 0, &c));
+	CHECK((c != a) && (c != b));
+
+	limare_mem_retire(state, 0xFFFFFFFE);
+	CHECK(state->mem_used == 0x300);
+
+	limare_mem_retire(state, 0xFFFFFFFF);
+	CHECK(state->mem_used == 0x200);
+
+	limare_mem_retire(state, 0);
+	CHECK(state->mem_used == 0x100);
+	CHECK(!state->mem_deferred);
+
+	free(state->mem_heap->address);
+	mem_heap_destroy(state->mem_heap);
+	free(state);
+}
+
+static void
+test_ring_undo(void)
+{
+	struct mem_ring *ring = mem_ring_create(HEAP_PHYSICAL, NULL, 0x1000);
+
+	CHECK(mem_ring_alloc(ring, 0x100, 0) == 0);
+	CHECK(!mem_ring_frame_end(ring, 1));
+
+	/* a frame that did not make it to the gpu keeps its memory. */
+	mem_ring_frame_undo(ring);
+	CHECK(ring->frame_count == 0);
+	CHECK(ring->frame_used == 0x100);
+
+	CHECK(mem_ring_alloc(ring, 0x100, 0) == 0x100);
+	CHECK(!mem_ring_frame_end(ring, 1));
+	CHECK(ring->frames[ring->frame_first].used == 0x200);
+
+	mem_ring_retire(ring, 1);
+	CHECK(ring->used == 0);
+
+	mem_ring_destroy(ring);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_alignment();
+	test_first_fit();
+	test_merge();
+	test_exhaustion();
+	test_big_blocks();
+	test_deferred();
+	test_ring_undo();
+
+	if (failures) {
+		printf("mem_heap: %d checks failed.\n", failures);
+		return 1;
+	}
+
+	printf("mem_heap: all checks passed.\n");
+	return 0;
+}
@@ -103,7 +103,7 @@ main(int argc, char *argv[])
 
 	fb_dump(state->pp->frame_address, 0, state->width, state->height);
 
-	limare_finish();
+	limare_finish(state);
 
 	return 0;
 }
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2011-2012 Luc Verhaegen <libv@codethink.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sub license,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replays a recording every frame, with the pipeline on, and patches its
+ * uniforms in between. A patch must never touch memory which a frame that
+ * is still rendering reads, so every frame which replayed the recording
+ * before has to have finished by the time a patch returns.
+ *
+ * Runs on the simulated backend, with slow jobs so that frames overlap,
+ * unless LIMARE_BACKEND says otherwise.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <GLES2/gl2.h>
+
+#include "limare.h"
+#include "program.h"
+
+#define WIDTH 800
+#define HEIGHT 480
+
+#define FRAMES 32
+
+static struct limare_fence *fences[FRAMES];
+
+/*
+ * All frames before the current one replayed the recording.
+ */
+static int
+frames_check(struct limare_state *state, int frame, const char *what)
+{
+	int i, failures = 0;
+
+	for (i = 0; i < frame; i++) {
+		if (!fences[i] || limare_fence_query(state, fences[i]))
+			continue;
+
+		printf("Error: frame %d: %s while frame %d is rendering.\n",
+		       frame, what, i);
+		failures++;
+	}
+
+	return failures;
+}
+
+static int
+uniform_patch(struct limare_state *state, struct limare_recording *recording,
+	      int frame)
+{
+	float color[4] = { (frame & 0x07) / 7.0, 0.5, 0.5, 1.0 };
+	int ret;
+
+	ret = limare_recording_uniform_attach(state, recording, -1, "uColor",
+					      4, 4, color);
+	if (ret < 0)
+		return ret;
+
+	if (ret != 2) {
+		printf("Error: frame %d: %d draws patched, instead of 2.\n",
+		       frame, ret);
+		return -1;
+	}
+
+	/* the same contents again change nothing. */
+	ret = limare_recording_uniform_attach(state, recording, -1, "uColor",
+					      4, 4, color);
+	if (ret) {
+		printf("Error: frame %d: %d draws patched, instead of 0.\n",
+		       frame, ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct limare_state *state;
+	struct limare_recording *recording;
+	int i, ret, failures = 0;
+
+	float vertices[] = { 0.0, -0.6, 0.0,
+			     0.4, 0.6, 0.0,
+			     -0.4, 0.6, 0.0};
+	float offsets[2][4] = {{ -0.5, 0.0, 0.0, 0.0 },
+			       { 0.5, 0.0, 0.0, 0.0 }};
+	float color[4] = { 0.0, 0.0, 0.0, 1.0 };
+
+	const char *vertex_shader_source =
+		"attribute vec4 aPosition;    \n"
+		"uniform vec4 uOffset;        \n"
+		"                             \n"
+		"void main()                  \n"
+		"{                            \n"
+		"    gl_Position = aPosition + uOffset;\n"
+		"}                            \n";
+	const char *fragment_shader_source =
+		"precision mediump float;     \n"
+		"uniform vec4 uColor;         \n"
+		"                             \n"
+		"void main()                  \n"
+		"{                            \n"
+		"    gl_FragColor = uColor;   \n"
+		"}                            \n";
+
+	setenv("LIMARE_BACKEND", "sim", 0);
+	setenv("LIMARE_SIM_LATENCY", "20000", 0);
+
+	state = limare_init();
+	if (!state)
+		return -1;
+
+	state->pipeline = 1;
+
+	ret = limare_state_setup(state, WIDTH, HEIGHT, 0xFF505050);
+	if (ret)
+		return ret;
+
+	vertex_shader_attach(state, vertex_shader_source);
+	fragment_shader_attach(state, fragment_shader_source);
+
+	ret = limare_link(state);
+	if (ret)
+		return ret;
+
+	/* two triangles, side by side. */
+	recording = limare_record_begin(state, 0);
+	if (!recording)
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		limare_attribute_pointer(state, "aPosition", 4, 3, vertices);
+		limare_uniform_attach(state, "uOffset", 4, 4, offsets[i]);
+		limare_uniform_attach(state, "uColor", 4, 4, color);
+
+		ret = limare_draw_arrays(state, GL_TRIANGLES, 0, 3);
+		if (ret)
+			return ret;
+	}
+
+	ret = limare_record_end(state);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < FRAMES; i++) {
+		/* both orders, as a patch also hits replays of this frame. */
+		if (i & 1) {
+			ret = uniform_patch(state, recording, i);
+			if (ret)
+				return ret;
+			failures += frames_check(state, i, "patched");
+
+			ret = limare_replay(state, recording);
+			if (ret)
+				return ret;
+		} else {
+			ret = limare_replay(state, recording);
+			if (ret)
+				return ret;
+
+			ret = uniform_patch(state, recording, i);
+			if (ret)
+				return ret;
+			failures += frames_check(state, i, "patched");
+		}
+
+		fences[i] = limare_flush_async(state);
+		if (!fences[i])
+			return -1;
+	}
+
+	ret = limare_finish(state);
+	if (ret)
+		return ret;
+
+	limare_recording_destroy(state, recording);
+
+	for (i = 0; i < FRAMES; i++)
+		limare_fence_release(state, fences[i]);
+
+	limare_fini(state);
+
+	if (failures) {
+		printf("replay_pipelined: %d patches raced the gpu.\n",
+		       failures);
+		return 1;
+	}
+
+	printf("replay_pipelined: all %d frames patched safely.\n", FRAMES);
+	return 0;
+}
@@ -52,21 +52,29 @@ main(int argc, char *argv[])
 	if (ret)
 		return ret;
 
-	ret = limare_gp_job_start_direct(state, &gp_job);
+	ret = limare_gp_job_start_direct(state, &gp_job,
+					 LIMARE_PRIORITY_NORMAL,
+					 LIMARE_WATCHDOG_DEFAULT, NULL, NULL);
 	if (ret)
 		return ret;
 
 	fb_clear();
 
 #ifdef LIMA_M400
-	ret = limare_m400_pp_job_start_direct(state, &pp_job);
+	ret = limare_m400_pp_job_start_direct(state, &pp_job,
+					      LIMARE_PRIORITY_NORMAL,
+					      LIMARE_WATCHDOG_DEFAULT,
+					      NULL, NULL);
 #else
-	ret = limare_m200_pp_job_start_direct(state, &pp_job);
+	ret = limare_m200_pp_job_start_direct(state, &pp_job,
+					      LIMARE_PRIORITY_NORMAL,
+					      LIMARE_WATCHDOG_DEFAULT,
+					      NULL, NULL);
 #endif
 	if (ret)
 		return ret;
 
-	limare_jobs_wait();
+	limare_jobs_wait(state);
 
 	bmp_dump(mem_0x40080000.address, 0,
 		 dump_render_width, dump_render_height, "/sdcard/limare.bmp");
@@ -74,7 +82,7 @@ main(int argc, char *argv[])
 	fb_dump(mem_0x40080000.address, 0,
 		dump_render_width, dump_render_height);
 
-	limare_finish();
+	limare_finish(state);
 
 	return 0;
 }
@@ -27,6 +27,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include <GLES2/gl2.h>
 
@@ -41,6 +44,64 @@
 #define WIDTH 800
 #define HEIGHT 480
 
+/*
+ * Renders the frame again on the cpu, as a golden image, and tells how far
+ * the pp is off from it.
+ */
+static int
+reference_compare(struct limare_state *state, unsigned int *frame)
+{
+	unsigned int *reference;
+	struct timespec start, end;
+	int i, j, different = 0, difference_max = 0;
+	int ret;
+
+	reference = malloc(WIDTH * HEIGHT * 4);
+	if (!reference) {
+		printf("%s: Error: failed to allocate: %s\n", __func__,
+		       strerror(errno));
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = limare_reference_render(state, reference, 0);
+	if (ret) {
+		free(reference);
+		return ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	bmp_dump((char *) reference, state, "/sdcard/limare_reference.bmp");
+
+	for (i = 0; i < (WIDTH * HEIGHT); i++) {
+		int difference = 0;
+
+		for (j = 0; j < 32; j += 8) {
+			int channel = ((frame[i] >> j) & 0xFF) -
+				((reference[i] >> j) & 0xFF);
+
+			if (channel < 0)
+				channel = -channel;
+			if (channel > difference)
+				difference = channel;
+		}
+
+		if (difference > 2)
+			different++;
+		if (difference > difference_max)
+			difference_max = difference;
+	}
+
+	printf("Reference: rendered in %lldus, %d pixels differ, by up to "
+	       "%d.\n", ((end.tv_sec - start.tv_sec) * 1000000LL) +
+	       ((end.tv_nsec - start.tv_nsec) / 1000), different,
+	       difference_max);
+
+	free(reference);
+
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -85,6 +146,9 @@ main(int argc, char *argv[])
 	if (ret)
 		return ret;
 
+	/* the reference renderer works from the decoded command streams. */
+	limare_command_stats_enable(state);
+
 	vertex_shader_attach(state, vertex_shader_source);
 	fragment_shader_attach(state, fragment_shader_source);
 
@@ -103,9 +167,11 @@ main(int argc, char *argv[])
 
 	bmp_dump(state->pp->frame_address, state, "/sdcard/limare.bmp");
 
+	reference_compare(state, state->pp->frame_address);
+
 	fb_dump(state->pp->frame_address, 0, state->width, state->height);
 
-	limare_finish();
+	limare_finish(state);
 
 	return 0;
 }